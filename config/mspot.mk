@@ -13,6 +13,10 @@ WWWDIR = /usr/local/www
 # For example, if you are planning to use systemd to run mspot, set USE_TS to false.
 USE_TS = true
 
+# The receiver's matched filter and sync search normally work in floating point.
+# On a Pi without fast floating point, set FIXED_POINT_RX to true to use 16/32-bit integers instead.
+FIXED_POINT_RX = false
+
 # DEBUG is for software debugging support.
 # if mspot is crashing or locking up, set this to true and run it manually.
 # If it is crashing, do "ulimit -c unlimited" before starting "./mspot mspot.ini",
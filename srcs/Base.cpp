@@ -49,6 +49,7 @@ void CBase::Log(EUnit unit, const char* fmt, ...) const
 		case EUnit::sock: printf("SockAddr, "); break;
 		case EUnit::udp:  printf("UDP, ");      break;
 		case EUnit::db:   printf("SQLite, ");   break;
+		case EUnit::loop: printf("Loop, ");     break;
 		case EUnit::null: default:              break;
 	}
 
@@ -23,6 +23,7 @@
 #include <atomic>
 #include <math.h>
 #include <stdarg.h>
+#include <algorithm>
 
 #include <netinet/ip_icmp.h>
 #include <netinet/udp.h>
@@ -32,7 +33,7 @@
 #include <sys/time.h>
 #include <arpa/inet.h>
 
-#include "poll.h"
+#include <sys/epoll.h>
 #include <fcntl.h> 
 #include <sys/ioctl.h>
 #include <time.h>
@@ -45,6 +46,7 @@
 #include "GateState.h"
 #include "Gateway.h"
 #include "CC1200.h"
+#include "EventLoop.h"
 #include "Random.h"
 #include "CRC.h"
 
@@ -53,53 +55,10 @@ extern CConfigure g_Cfg;
 extern CGateway   g_Gateway;
 extern CRandom    g_RNG;
 extern CCRC       g_Crc;
+extern CEventLoop g_EventLoop;
 extern IPFrameFIFO Modem2Gate;
 extern IPFrameFIFO Gate2Modem;
 
-//CC1200 commands
-enum cmd_t
-{
-	CMD_PING,
-
-	//SET
-	CMD_SET_RX_FREQ,
-	CMD_SET_TX_FREQ,
-	CMD_SET_TX_POWER,
-	CMD_SET_RESERVED,
-	CMD_SET_FREQ_CORR,
-	CMD_SET_AFC,
-	CMD_TX_START,
-	CMD_RX_START,
-	CMD_RX_DATA,
-	CMD_TX_DATA,
-	CMD_DBG_ENABLE,
-	CMD_DBG_TXT,
-
-	//GET
-	CMD_GET_IDENT = 0x80,
-	CMD_GET_CAPS,
-	CMD_GET_RX_FREQ,
-	CMD_GET_TX_FREQ,
-	CMD_GET_TX_POWER,
-	CMD_GET_FREQ_CORR,
-	CMD_GET_BSB_BUFF,
-	CMD_GET_RSSI
-};
-
-#define RX_SYMBOL_SCALING_COEFF	(1.0f/(0.8f/(40.0e3f/2097152*0xAD)*130.0f))
-// CC1200 User's Guide, p. 24
-// 0xAD is `DEVIATION_M`, 2097152=2^21
-// +1.0 is the symbol for +0.8kHz
-// 40.0e3 is F_TCXO in kHz
-// 129 is `CFM_RX_DATA_OUT` register value at max. F_DEV (130 is 1 off but offers a better symbol map)
-// datasheet might have this wrong (it says 64)
-
-#define TX_SYMBOL_SCALING_COEFF	(0.8f/((40.0e3f/2097152)*0xAD)*64.0f)
-// 0xAD is `DEVIATION_M`, 2097152=2^21
-// +0.8kHz is the deviation for symbol +1
-// 40.0e3 is F_TCXO in kHz
-// 64 is `CFM_TX_DATA_IN` register value for max. F_DEV
-
 //debug printf
 
 uint32_t CCC1200::getMS(void)
@@ -226,6 +185,13 @@ bool CCC1200::loadConfig()
 	cfg.afc      = g_Cfg.GetBoolean (g_Keys.modem.section,    g_Keys.modem.afc);
 	cfg.isV3     = g_Cfg.GetBoolean (g_Keys.repeater.section, g_Keys.repeater.radioTypeIsV3);
 	cfg.debug    = g_Cfg.GetBoolean (g_Keys.modem.section,    g_Keys.modem.debug);
+	cfg.rxDemodCore  = g_Cfg.GetInt (g_Keys.modem.section,    g_Keys.modem.rxDemodCore);
+	if (g_Cfg.Contains(g_Keys.modem.section, g_Keys.modem.captureFolder))
+		cfg.captureFolder = g_Cfg.GetString(g_Keys.modem.section, g_Keys.modem.captureFolder);
+	cfg.captureFileSize = g_Cfg.GetUnsigned(g_Keys.modem.section, g_Keys.modem.captureFileSize);
+	cfg.captureFiles    = g_Cfg.GetUnsigned(g_Keys.modem.section, g_Keys.modem.captureFiles);
+	cfg.txJitterDepth    = g_Cfg.GetUnsigned(g_Keys.modem.section, g_Keys.modem.txJitterDepth);
+	cfg.txJitterMaxDepth = g_Cfg.GetUnsigned(g_Keys.modem.section, g_Keys.modem.txJitterMaxDepth);
 	cfg.callSign.CSIn(g_Cfg.GetString(g_Keys.repeater.section, g_Keys.repeater.callsign));
 	cfg.callSign.SetModule(g_Cfg.GetString(g_Keys.repeater.section, g_Keys.repeater.module).at(0));
 	return false;
@@ -338,27 +304,80 @@ void CCC1200::gpioCleanup()
 	Log(EUnit::cc12, "GPIO lines set to low and resources released\n");
 }
 
-bool CCC1200::readDev(void *vbuf, int size)
+// Send a command and get a future for the device's reply, the whole frame, header and all.
+// rxRead() is the only reader of the UART, it hands each reply to the request waiting for its command id.
+// There can only be one request waiting for each command id, a new one replaces an old one.
+std::future<SReply> CCC1200::request(const uint8_t *cmd, size_t size, const char *what)
 {
-	uint8_t *buf = static_cast<uint8_t *>(vbuf);
-	int rd = 0;
-	while (rd < size)
+	std::future<SReply> reply;
 	{
-		int r = read(fd, buf + rd, size - rd);
-		if (r < 0) {
-			Log(EUnit::cc12, "read() %s returned error: %s", cfg.uartDev.c_str(), strerror(errno));
-			return true;
-		} else if (r == 0) {
-			Log(EUnit::cc12, "read() %s returned zero bytes\n", cfg.uartDev.c_str());
-			return true;
+		std::lock_guard<std::mutex> lg(cmd_mtx);
+		auto &pr = pending[cmd[0]];
+		pr = std::promise<SReply>();
+		reply = pr.get_future();
+	}
+	writeDev(cmd, size, what);
+	return reply;
+}
+
+// send a command and wait for the reply, returns true on error
+bool CCC1200::command(const uint8_t *cmd, size_t size, SReply &reply, const char *what, unsigned timeout_ms)
+{
+	auto fut = request(cmd, size, what);
+	if (std::future_status::ready != fut.wait_for(std::chrono::milliseconds(timeout_ms)))
+	{
+		{
+			std::lock_guard<std::mutex> lg(cmd_mtx);
+			pending.erase(cmd[0]);
 		}
-		rd += r;
+		Log(EUnit::cc12, "In %s, no reply from the device after %u ms\n", what, timeout_ms);
+		return true;
 	}
+	reply = fut.get();
 	return false;
 }
 
-void CCC1200::writeDev(void *buf, int size, const char *where)
+// the same, but the first rsize bytes of the reply go in resp
+bool CCC1200::command(const uint8_t *cmd, size_t size, uint8_t *resp, size_t rsize, const char *what, unsigned timeout_ms)
 {
+	SReply reply;
+	if (command(cmd, size, reply, what, timeout_ms))
+		return true;
+	memset(resp, 0, rsize);
+	memcpy(resp, reply.data(), std::min(rsize, reply.size()));
+	return false;
+}
+
+// rxRead() found a reply, give it to whoever is waiting for it
+void CCC1200::deliver(SReply &reply)
+{
+	if (CMD_DBG_TXT == reply[0])
+	{
+		Log(EUnit::cc12, "Device: %.*s\n", int(reply.size() - 3), (const char *)reply.data() + 3);
+		return;
+	}
+	std::lock_guard<std::mutex> lg(cmd_mtx);
+	auto it = pending.find(reply[0]);
+	if (pending.end() != it)
+	{
+		it->second.set_value(std::move(reply));
+		pending.erase(it);
+	}
+}
+
+// is this a command id we're waiting on a reply for
+bool CCC1200::isExpected(uint8_t cid)
+{
+	if (CMD_DBG_TXT == cid)
+		return true;
+	std::lock_guard<std::mutex> lg(cmd_mtx);
+	return pending.end() != pending.find(cid);
+}
+
+void CCC1200::writeDev(const void *buf, int size, const char *where)
+{
+	// the commands and the TX data come from different threads, each has to go out whole
+	std::lock_guard<std::mutex> lg(write_mtx);
 	ssize_t n = write(fd, buf, size);
 	if (n < 0) {
 		Log(EUnit::cc12, "In %s, write() error: %s\n", where, strerror(errno));
@@ -368,6 +387,17 @@ void CCC1200::writeDev(void *buf, int size, const char *where)
 	return;
 }
 
+// wrap each frame of modulated baseband samples in a CMD_TX_DATA command and send it
+void CCC1200::writeBsb(const int8_t *samples, unsigned frames, const char *where)
+{
+	int8_t bsb_chunk[TX_BLOCK_LEN+3] = {CMD_TX_DATA, -61, 3};	// baseband samples wrapped in a frame
+	for (unsigned i=0; i<frames; i++)
+	{
+		memcpy(bsb_chunk+3, samples + i*TX_BLOCK_LEN, TX_BLOCK_LEN);
+		writeDev(bsb_chunk, sizeof(bsb_chunk), where);
+	}
+}
+
 //device config funcs
 bool CCC1200::pingDev()
 {
@@ -375,11 +405,7 @@ bool CCC1200::pingDev()
 	uint8_t cmd[3] = { cid, 3, 0 };
 	uint8_t resp[7] = { 0 };
 
-    tcflush(fd, TCIFLUSH); // clear leftover bytes
-
-    writeDev(cmd, 3, "pingDev");
-
-    if (readDev(resp, sizeof(resp)))
+	if (command(cmd, 3, resp, sizeof(resp), "pingDev"))
 	{
 		return true;
 	}
@@ -387,16 +413,37 @@ bool CCC1200::pingDev()
 	const uint8_t good[7] { cid, 7, 0, 0, 0, 0, 0 };
     if (0 == memcmp(resp, good, 7))
 	{
-		Log(EUnit::null, "PONG OK\n"); //OK
+		Log(EUnit::cc12, "Radio board's reply to PING: PONG OK\n"); //OK
         return false;
     }
 
 	uint32_t dev_err;
 	memcpy((uint8_t*)&dev_err, &resp[3], sizeof(uint32_t));
-    Log(EUnit::null, "%02x %02x %02x PONG error code: %04X\n", resp[0], resp[1], resp[2], dev_err);
+    Log(EUnit::cc12, "Radio board's reply to PING: %02x %02x %02x PONG error code: %04X\n", resp[0], resp[1], resp[2], dev_err);
     return true;
 }
 
+// After the reset is released, PING the device with a short timeout until it answers.
+// pings is how many it took, returns true if it didn't answer within DEV_BOOT_MS.
+bool CCC1200::waitReady(unsigned &pings)
+{
+	const uint8_t cmd[3] { CMD_PING, 3, 0 };
+	const auto start = getMS();
+	pings = 0;
+	do
+	{
+		pings++;
+		auto fut = request(cmd, 3, "waitReady");
+		if (std::future_status::ready == fut.wait_for(std::chrono::milliseconds(READY_PING_MS)))
+			return false;
+		std::lock_guard<std::mutex> lg(cmd_mtx);
+		pending.erase(CMD_PING);
+	} while (getMS() - start < DEV_BOOT_MS);
+
+	Log(EUnit::cc12, "The device didn't answer any of %u PINGs in %u ms\n", pings, DEV_BOOT_MS);
+	return true;
+}
+
 bool CCC1200::setRxFreq(uint32_t freq)
 {
 	uint8_t cid = CMD_SET_RX_FREQ;
@@ -404,11 +451,7 @@ bool CCC1200::setRxFreq(uint32_t freq)
 	memcpy(&cmd[3], (uint8_t*)&freq, sizeof(freq));
 	uint8_t resp[4] = { 0 };
 
-    tcflush(fd, TCIFLUSH);    //clear leftover bytes
-
-    writeDev(cmd, 7, "setRxFreq");
-
-    if (readDev(resp, sizeof(resp)))
+	if (command(cmd, 7, resp, sizeof(resp), "setRxFreq"))
 	{
 		return true;
 	}
@@ -432,11 +475,7 @@ bool CCC1200::setTxFreq(uint32_t freq)
 	memcpy(&cmd[3], (uint8_t*)&freq, sizeof(freq));
 	uint8_t resp[4] = { 0 };
 
-    tcflush(fd, TCIFLUSH);    //clear leftover bytes
-
-    writeDev(cmd, 7, "setTxFreq");
-
-    if (readDev(resp, sizeof(resp)))
+	if (command(cmd, 7, resp, sizeof(resp), "setTxFreq"))
 	{
 		return true;
 	}
@@ -459,11 +498,7 @@ bool CCC1200::setFreqCorr(int16_t corr)
 	uint8_t cmd[5] = {cid, 5, 0, uint8_t(corr&0xffu), uint8_t((corr>>8)&0xffu)};
 	uint8_t resp[4] = { 0 };
 
-    tcflush(fd, TCIFLUSH);    //clear leftover bytes
-
-    writeDev(cmd, 5, "setFreqCorr");
-
-	if (readDev(resp, sizeof(resp)))
+	if (command(cmd, 5, resp, sizeof(resp), "setFreqCorr"))
 	{
 		return true;
 	}
@@ -486,11 +521,7 @@ bool CCC1200::setAfc(bool en)
 	uint8_t cmd[3+1] = { cid, 4, 0, uint8_t(en ? 0 : 1) };
 	uint8_t resp[4] = { 0 };
 
-    tcflush(fd, TCIFLUSH);    //clear leftover bytes
-
-    writeDev(cmd, 4, "setAfc");
-
-    if (readDev(resp, sizeof(resp)))
+	if (command(cmd, 4, resp, sizeof(resp), "setAfc"))
 	{
 		return true;
 	}
@@ -513,11 +544,7 @@ bool CCC1200::setTxPower(float power) //powr in dBm
 	uint8_t cmd[4] = { cid, 4, 0, uint8_t(roundf(power*4.0f)) };
 	uint8_t resp[4] = { 0 };
 
-    tcflush(fd, TCIFLUSH);    //clear leftover bytes
-
-    writeDev(cmd, 4, "setTxPower");
-
-    if (readDev(resp, sizeof(resp)))
+	if (command(cmd, 4, resp, sizeof(resp), "setTxPower"))
 	{
 		return true;
 	}
@@ -536,156 +563,312 @@ bool CCC1200::setTxPower(float power) //powr in dBm
 
 void CCC1200::startRx(void)
 {
-	uart_lock = true;
 	while (txrxControl(CMD_TX_START, 0, "stop_tx"))
-		usleep(40000);
-	reset_rx();
+		usleep(TXRX_RETRY_US);
 	while(txrxControl(CMD_RX_START, 1, "start_rx"))
-		usleep(40000);
-	uart_lock = false;
+		usleep(TXRX_RETRY_US);
 }
 
 void CCC1200::startTx(void)
 {
-	uart_lock = true;
+	// a new transmission, try the buffer level again, unless the firmware doesn't have it
+	if (bsb_buff_seen)
+	{
+		bsb_buff_ok = true;
+		bsb_buff_misses = 0;
+	}
 	while (txrxControl(CMD_RX_START, 0, "stop_rx"))
-		usleep(40000);
-	reset_rx();
+		usleep(TXRX_RETRY_US);
 	while (txrxControl(CMD_TX_START, 1, "start_tx"))
-		usleep(40000);
-	uart_lock = false;
+		usleep(TXRX_RETRY_US);
 }
 
-err_t CCC1200::txrxControl(uint8_t cid, uint8_t onoff, const char *what)
+void CCC1200::Retune(const CConfigure &newcfg)
 {
-	uint8_t cmd[4] { cid, 4, 0, onoff };
-	uint8_t resp[4] = { 0 };
+	std::lock_guard<std::mutex> lck(retune_mtx);
+	retune_cfg.rxFreq   = newcfg.GetUnsigned(g_Keys.modem.section, g_Keys.modem.rxFreq);
+	retune_cfg.txFreq   = newcfg.GetUnsigned(g_Keys.modem.section, g_Keys.modem.txFreq);
+	retune_cfg.freqCorr = newcfg.GetInt     (g_Keys.modem.section, g_Keys.modem.freqCorr);
+	retune_cfg.power    = newcfg.GetFloat   (g_Keys.modem.section, g_Keys.modem.txPower);
+	retune_cfg.afc      = newcfg.GetBoolean (g_Keys.modem.section, g_Keys.modem.afc);
+	retune_pending = true;
+	Gate2Modem.Wake();
+	Log(EUnit::cc12, "New radio settings will be applied when the transmitter is idle\n");
+}
 
-	tcflush(fd, TCIFLUSH);    //clear leftover bytes
+// Called by txProcess when it's idle. Only the settings that changed are sent to the device,
+// and RX is only stopped when a receive setting changed, just long enough to set them.
+void CCC1200::applyRetune(void)
+{
+	SConfig next;
+	{
+		std::lock_guard<std::mutex> lck(retune_mtx);
+		next = retune_cfg;
+		retune_pending = false;
+	}
 
-	writeDev(cmd, 4, what);
+	const auto start = getMS();
+	unsigned changed = 0, failed = 0;
+	if (next.txFreq != cfg.txFreq)
+	{
+		changed++;
+		if (setTxFreq(next.txFreq))
+			failed++;
+		else
+			cfg.txFreq = next.txFreq;
+	}
+	if (next.power != cfg.power)
+	{
+		changed++;
+		if (setTxPower(next.power))
+			failed++;
+		else
+			cfg.power = next.power;
+	}
 
-	err_t rval = ERR_OTHER;
-	if (not readDev(resp, sizeof(resp)))
+	uint32_t paused = 0;
+	if (next.rxFreq != cfg.rxFreq or next.freqCorr != cfg.freqCorr or next.afc != cfg.afc)
 	{
-		const uint8_t good[3] { cid, 4, 0 };
-		if (0 == memcmp(resp, good, 3)) {
-			if (ERR_OK == resp[3] or ERR_NOP == resp[3])
-				rval = ERR_OK;
+		const auto stopped = getMS();
+		while (txrxControl(CMD_RX_START, 0, "stop_rx"))
+			usleep(TXRX_RETRY_US);
+		if (next.rxFreq != cfg.rxFreq)
+		{
+			changed++;
+			if (setRxFreq(next.rxFreq))
+				failed++;
 			else
-			{
-				Log(EUnit::cc12, "%s returned error value %d\n", what, int(resp[3]));
-			}
+				cfg.rxFreq = next.rxFreq;
 		}
+		if (next.freqCorr != cfg.freqCorr)
+		{
+			changed++;
+			if (setFreqCorr(next.freqCorr))
+				failed++;
+			else
+				cfg.freqCorr = next.freqCorr;
+		}
+		if (next.afc != cfg.afc)
+		{
+			changed++;
+			if (setAfc(next.afc))
+				failed++;
+			else
+				cfg.afc = next.afc;
+		}
+		while (txrxControl(CMD_RX_START, 1, "start_rx"))
+			usleep(TXRX_RETRY_US);
+		paused = getMS() - stopped;
 	}
-	return rval;
-}
 
-void CCC1200::reset_rx()
-{
-	rx_header.Clear();
-	uart_rx_data_valid = false;
-	rx_buff_cnt = 0;
-	uart_sync = false;
+	if (0u == changed)
+		Log(EUnit::cc12, "None of the radio settings changed\n");
+	else
+		Log(EUnit::cc12, "%u radio setting%s applied in %u ms, %u failed, RX was paused for %u ms\n", changed, (1u == changed) ? "" : "s", getMS() - start, failed, paused);
 }
 
-bool CCC1200::getFwVersion()
+// How many baseband samples the device still has to transmit.
+// The reply is {CMD_GET_BSB_BUFF, len lo, len hi} followed by the level, little-endian.
+// Returns true on error, or if there was no reply in time.
+bool CCC1200::getBsbBuff(unsigned &level)
 {
-	uint8_t cid = CMD_GET_IDENT;
+	uint8_t cid = CMD_GET_BSB_BUFF;
 	uint8_t cmd[3] { cid, 3, 0 };
-	uint8_t resp[3] { 0 };
+	SReply resp;
 
-	tcflush(fd, TCIFLUSH);
-
-	writeDev(cmd, 3, "getFWVersion");
-
-	if (readDev(resp, sizeof(resp)))
+	// older firmware might not answer, so don't wait on it for long
+	if (command(cmd, 3, resp, "getBsbBuff", 40u))
+		return true;
+	if (resp.size() < 4 or resp.size() > 7)
 	{
+		Log(EUnit::cc12, "Unexpected getBsbBuff response size: %u\n", unsigned(resp.size()));
 		return true;
 	}
-	
-	if (CMD_GET_IDENT == resp[0])
+	level = 0;
+	for (size_t i=resp.size()-1; i>2; i--)
+		level = (level << 8) | resp[i];
+	return false;
+}
+
+// The buffer level for TX flow control, returns true if there isn't one this time.
+// A query that isn't answered only costs that one level, it takes TX_BSB_MAX_MISSES
+// in a row to give up on it for the rest of the transmission.
+bool CCC1200::bsbLevel(unsigned &level)
+{
+	if (not bsb_buff_ok)
+		return true;
+	if (not getBsbBuff(level))
 	{
-		size_t size = 0x100u * resp[2] + resp[1];
-		if (size > 3)
-		{
-			char fwv[size-2] { 0 };
-			if (readDev(fwv, size-3))
-				return true;
-			for (int i=0; fwv[i]; i++) if ('\n' == fwv[i]) fwv[i] = ' ';
-			Log(EUnit::cc12, "CC1200 Firmware Version: %s\n", fwv);
-		}
-		else
-			Log(EUnit::cc12, "CC1200 Version string has size 0!\n");
+		bsb_buff_seen = true;
+		bsb_buff_misses = 0;
 		return false;
 	}
-	Log(EUnit::cc12, "Unexpected getFwVersion response: %02x %02x %02x\n", resp[0], resp[1], resp[2]);
+	if (++bsb_buff_misses >= TX_BSB_MAX_MISSES)
+	{
+		bsb_buff_ok = false;
+		if (bsb_buff_seen)
+			Log(EUnit::cc12, "The device didn't report its baseband buffer level %u times in a row, TX will use fixed waits until the next transmission\n", bsb_buff_misses);
+		else
+			Log(EUnit::cc12, "The device doesn't report its baseband buffer level, TX will use fixed waits\n");
+	}
 	return true;
 }
 
-//new, polyphase filter implementation
-void CCC1200::filterSymbols(int8_t* __restrict out, const int8_t* __restrict in, const float* __restrict flt, uint8_t phase_inv)
+// Wait until the device has sent every baseband sample it was given, so the transmitter can
+// be turned around the moment it's done. Without the buffer level, this waits fixed_ms.
+void CCC1200::waitTxDone(unsigned fixed_ms)
 {
-	#define FLT_LEN 41
-    #define TAPS_PER_PHASE 9
-
-	//history
-	static float sr[TAPS_PER_PHASE * 2] = { 0 };
-	static uint8_t w = 0;
-
-	//flush filter state
-	if (in == nullptr)
+	const auto start = getMS();
+	uint32_t limit = 0;
+	unsigned level;
+	while (bsb_buff_ok)
 	{
-		memset(sr, 0, sizeof(sr));
-		w = 0;
-		return;
+		if (bsbLevel(level))
+			continue;	// ask again, until bsbLevel() gives up
+		const auto elapsed = getMS() - start;
+		if (0u == level)
+		{
+			if (cfg.debug)
+				Log(EUnit::cc12, "TX buffer drained in %u ms\n", elapsed);
+			return;
+		}
+		if (0u == limit)
+			limit = 40u * (level / TX_BLOCK_LEN + 3u);	// what's there, and then some
+		else if (elapsed > limit)
+		{
+			Log(EUnit::cc12, "The TX buffer still has %u samples after %u ms, switching to RX anyway\n", level, elapsed);
+			return;
+		}
+		// about as long as it takes to send what's left
+		usleep(std::max(TX_BSB_MIN_POLL_US, level * 125u / 3u));
 	}
+	usleep(fixed_ms * 1000u);
+}
 
-	//precompute gain and sign once
-    static const float gain = TX_SYMBOL_SCALING_COEFF*sqrtf(5.0f);
-	const float sign = phase_inv ? -1.0f : 1.0f;
+err_t CCC1200::txrxControl(uint8_t cid, uint8_t onoff, const char *what)
+{
+	uint8_t cmd[4] { cid, 4, 0, onoff };
+	uint8_t resp[4] = { 0 };
 
-	for (uint16_t i = 0; i < SYM_PER_FRA; i++)
+	err_t rval = ERR_OTHER;
+	if (not command(cmd, 4, resp, sizeof(resp), what))
 	{
-		//insert new sample per symbol
-		const float x = (float)in[i] * sign;
-
-		//store once, duplicated for linear access
-		float * __restrict hp = &sr[w];
-		hp[0]			   = x;
-		hp[TAPS_PER_PHASE] = x;
-
-		//phase pointer
-		const float * __restrict tp = flt;
+		const uint8_t good[3] { cid, 4, 0 };
+		if (0 == memcmp(resp, good, 3)) {
+			if (ERR_OK == resp[3] or ERR_NOP == resp[3])
+				rval = ERR_OK;
+			else
+			{
+				Log(EUnit::cc12, "%s returned error value %d\n", what, int(resp[3]));
+			}
+		}
+	}
+	return rval;
+}
 
-		//generate sps (5) output samples
-		for (uint8_t ph = 0; ph < 5; ph++)
+// Incremental parser for everything coming from the device, each frame is a command id,
+// the little-endian frame length, including these 3 bytes, and the rest of the frame.
+// The CMD_RX_DATA frames are {CMD_RX_DATA, 0xC3, 0x03} (963) followed by 960 baseband samples,
+// anything else is only taken as a frame if a reply to that command is expected.
+// Consumes bytes from buf until a complete block of samples is in raw_bsb_rx
+// (uart_rx_data_valid is set) or until the input is exhausted. Replies are delivered as they complete.
+// Returns the number of bytes consumed.
+size_t CCC1200::parseRx(const uint8_t *buf, size_t size)
+{
+	size_t n = 0;
+	while (n < size and not uart_rx_data_valid)
+	{
+		switch (rx_parse)
 		{
-			float acc;
-
-			//fully unrolled 9-tap dot product
-			acc  = hp[0] * tp[0];
-			acc += hp[1] * tp[1];
-			acc += hp[2] * tp[2];
-			acc += hp[3] * tp[3];
-			acc += hp[4] * tp[4];
-			acc += hp[5] * tp[5];
-			acc += hp[6] * tp[6];
-			acc += hp[7] * tp[7];
-			acc += hp[8] * tp[8];
-
-			out[i*5 + ph] = (int8_t)(acc * gain);
-
-			//advance to next phase coefficients
-			tp += TAPS_PER_PHASE;
+			case ERxParse::cmd:
+				rx_cmd = buf[n];
+				if (CMD_RX_DATA == rx_cmd or isExpected(rx_cmd))
+					rx_parse = ERxParse::lenlo;
+				n++;
+				break;
+			case ERxParse::lenlo:
+				if (CMD_RX_DATA != rx_cmd or 0xC3u == buf[n])
+				{
+					rx_len = buf[n];
+					rx_parse = ERxParse::lenhi;
+					n++;
+				}
+				else
+					rx_parse = ERxParse::cmd; // re-examine this byte as a possible command
+				break;
+			case ERxParse::lenhi:
+				rx_len |= uint16_t(buf[n]) << 8;
+				if (CMD_RX_DATA == rx_cmd ? (963u == rx_len) : (rx_len >= 3u and rx_len <= CMD_REPLY_MAX))
+				{
+					rx_parse = ERxParse::payload;
+					rx_buff_cnt = 0;
+					n++;
+					if (CMD_RX_DATA != rx_cmd)
+					{
+						rx_reply.assign({ rx_cmd, uint8_t(rx_len & 0xffu), uint8_t(rx_len >> 8) });
+						if (3u == rx_len)
+						{
+							deliver(rx_reply);
+							rx_parse = ERxParse::cmd;
+						}
+					}
+				}
+				else
+					rx_parse = ERxParse::cmd;
+				break;
+			case ERxParse::payload:
+				if (CMD_RX_DATA == rx_cmd)
+				{
+					// copy as much of the payload as we have in one go
+					size_t count = std::min(size - n, size_t(960u - rx_buff_cnt));
+					memcpy(raw_bsb_rx + rx_buff_cnt, buf + n, count);
+					rx_buff_cnt += count;
+					n += count;
+					if (960u == rx_buff_cnt)
+					{
+						uart_rx_data_valid = true;
+						rx_buff_cnt = 0;
+						rx_parse = ERxParse::cmd;
+					}
+				}
+				else
+				{
+					size_t count = std::min(size - n, size_t(rx_len - rx_reply.size()));
+					rx_reply.insert(rx_reply.end(), buf + n, buf + n + count);
+					n += count;
+					if (rx_reply.size() == rx_len)
+					{
+						deliver(rx_reply);
+						rx_parse = ERxParse::cmd;
+					}
+				}
+				break;
 		}
+	}
+	return n;
+}
 
-		//circular index update without modulo
-		if (w == 0)
-			w = TAPS_PER_PHASE-1;
-		else
-			w--;
+bool CCC1200::getFwVersion()
+{
+	uint8_t cid = CMD_GET_IDENT;
+	uint8_t cmd[3] { cid, 3, 0 };
+	SReply resp;
+
+	if (command(cmd, 3, resp, "getFWVersion"))
+	{
+		return true;
+	}
+
+	if (resp.size() > 3)
+	{
+		std::string fwv((const char *)resp.data() + 3, resp.size() - 3);
+		fwv.resize(strnlen(fwv.c_str(), fwv.size()));
+		for (auto &c : fwv) if ('\n' == c) c = ' ';
+		Log(EUnit::cc12, "CC1200 Firmware Version: %s\n", fwv.c_str());
 	}
+	else
+		Log(EUnit::cc12, "CC1200 Version string has size 0!\n");
+	return false;
 }
 
 // returns true on error
@@ -698,51 +881,84 @@ bool CCC1200::Start()
 		return true;
 
 	//------------------------------------gpio init------------------------------------
-	Log(EUnit::cc12, "GPIO init: ");
-	if (gpioInit("mspot"))
-		return true;
-	if (gpioSetValue(cfg.nrst, 0)) //both pins should be at logic low already, but better be safe than sorry
-		return true;
-	usleep(250000U); //250ms
-	if (gpioSetValue(cfg.nrst, 1))
-		return true;
-	usleep(1000000U); //1s for device boot-up
-	Log(EUnit::null, "OK\n");
+	// the device is held in reset while the UART and its reader are set up
+	// without a gpiochip, as with cc1200-sim, there's no reset, the device is just PINGed
+	const auto t_start = getMS();
+	const bool useGpio = (0 != cfg.gpioDev.compare("none"));
+	if (useGpio)
+	{
+		if (gpioInit("mspot"))
+			return true;
+		if (gpioSetValue(cfg.nrst, 0)) //both pins should be at logic low already, but better be safe than sorry
+			return true;
+		usleep(NRST_PULSE_US);
+		Log(EUnit::cc12, "GPIO init: OK\n");
+	}
+	else
+		Log(EUnit::cc12, "GPIO init: skipped, there's no gpiochip\n");
+	const auto t_gpio = getMS();
 
 	//-----------------------------------device part-----------------------------------
-	Log(EUnit::cc12, "UART init: %s at %d baud: ", (char*)cfg.uartDev.c_str(), cfg.baudRate);
+	// the gateway is starting at the same time, so each log line goes out whole
+	Log(EUnit::cc12, "UART init: %s at %u baud\n", cfg.uartDev.c_str(), cfg.baudRate);
 	fd = open((char*)cfg.uartDev.c_str(), O_RDWR | O_NOCTTY | O_SYNC);
 	if (fd < 0) {
-		Log(EUnit::null, "open(%s) error: %s\n", cfg.uartDev.c_str(), strerror(errno));
+		Log(EUnit::cc12, "open(%s) error: %s\n", cfg.uartDev.c_str(), strerror(errno));
 		return true;
 	} else if (setAttributes(cfg.baudRate, 0)) {
 		return true;
-	} else {
-		Log(EUnit::null, "OK\n");
 	}
 
-	//PING-PONG test
-	Log(EUnit::cc12, "Radio board's reply to PING... ");
-	if (pingDev())
-		return true;
+	// a capture problem is logged, but it's not a reason to stop
+	if (not cfg.captureFolder.empty())
+		capture.Start(cfg.captureFolder, cfg.captureFileSize, cfg.captureFiles);
 
-	if (getFwVersion())
+	// from here on, the event loop reads the UART, even the replies to commands come from it
+	if (g_EventLoop.Add(fd, EPOLLIN, [this](uint32_t events) { rxRead(events); }))
+	{
+		capture.Stop();
 		return true;
+	}
+	const auto t_uart = getMS();
+
+	// let the device boot, it's ready when it answers a PING
+	unsigned pings = 0;
+	bool rval = (useGpio and gpioSetValue(cfg.nrst, 1)) or waitReady(pings);
+	const auto t_boot = getMS();
+
+	//PING-PONG test
+	if (not rval)
+		rval = pingDev() or getFwVersion();
 
 	//config the device
-	if (setRxFreq(cfg.rxFreq) or
+	if (rval or
+		setRxFreq(cfg.rxFreq) or
 		setTxFreq(cfg.txFreq) or
 		setFreqCorr(cfg.freqCorr) or
 		setTxPower(cfg.power) or
 		setAfc(cfg.afc))
 	{
+		g_EventLoop.Remove(fd);
+		capture.Stop();
 		return true;
 	}
+	const auto t_config = getMS();
 
 	startRx();
 
 	Log(EUnit::cc12, "Device start - RX\n");
 
+	// the cached preamble and EOT, so the first transmission doesn't have to make them
+	modulator.Prepare();
+
+	Log(EUnit::cc12, "Modem start-up took %u ms: GPIO reset %u, UART %u, device boot %u (%u PINGs), configuration %u, RX start and TX cache %u\n",
+		getMS() - t_start, t_gpio - t_start, t_uart - t_gpio, t_boot - t_uart, pings, t_config - t_boot, getMS() - t_config);
+
+	// the firmware gets to show it can report its buffer level
+	bsb_buff_ok = true;
+	bsb_buff_seen = false;
+	bsb_buff_misses = 0;
+
 	// start processes
 	keep_running = true;
 	txFuture = std::async(std::launch::async, &CCC1200::txProcess, this);
@@ -757,6 +973,10 @@ bool CCC1200::Start()
 	else
 		Log(EUnit::cc12, "Could not start the Tx Processing thread\n");
 	keep_running = false;
+	Gate2Modem.Wake();
+	if (txFuture.valid())
+		txFuture.get();
+	g_EventLoop.Remove(fd);
 	return true;
 }
 
@@ -764,15 +984,21 @@ void CCC1200::Stop()
 {
 	Log(EUnit::cc12, "Stopping tx/rx threads...\n");
 	keep_running = false;
+	Gate2Modem.Wake();
 	if (txFuture.valid())
 		txFuture.get();
 	if (rxFuture.valid())
 		rxFuture.get();
+	const auto &rs = demod.GetStats();
+	Log(EUnit::cc12, "Sync pre-detector: %llu of %llu searches passed to the SED check\n", (unsigned long long)rs.syncPasses, (unsigned long long)rs.syncSearches);
+	// the reader has to be running to get the replies, but don't wait forever on a dead device
 	Log(EUnit::cc12, "Stopping tx/rx on CC1200...\n");
-	while(txrxControl(CMD_TX_START, 0, "stop tx"))
+	for (unsigned i=0; i<5u and txrxControl(CMD_TX_START, 0, "stop tx"); i++)
 		usleep(40000);
-	while(txrxControl(CMD_RX_START, 0, "stop rx"))
+	for (unsigned i=0; i<5u and txrxControl(CMD_RX_START, 0, "stop rx"); i++)
 		usleep(40000);
+	g_EventLoop.Remove(fd);
+	capture.Stop();
 	Log(EUnit::cc12, "Stopping CC1200 UART...\n");
 	gpioCleanup();
 	if (fd >= 0)
@@ -786,13 +1012,24 @@ void CCC1200::txProcess()
 	ETxState tx_state = ETxState::idle;
 	SLSF txlsf;
 	CFrameType txType;
-	uint16_t frame_count;
-	uint16_t pfn;
-	std::unique_ptr<CPacket> p;
+	uint16_t frame_count = 0;
+	unsigned hang = 0;
+	std::chrono::steady_clock::time_point deadline;
+
+	jitter.Configure(cfg.txJitterDepth, cfg.txJitterMaxDepth);
 
 	while (keep_running)
 	{
-		auto p = Gate2Modem.PopWaitFor(40);
+		// while a stream or packets are going out, don't wait past the time to send more,
+		// and when there's nothing to do, sleep until the gateway sends something (or Wake())
+		int wait = -1;
+		if (ETxState::active == tx_state or ETxState::packet == tx_state)
+			wait = std::clamp(int(std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count()), 0, 40);
+		else if (ETxState::buffering == tx_state)
+			wait = std::clamp(int(40u * jitter.Target()) - int(getMS() - tx_timer), 0, 40);
+		else if (retune_pending or not tx_pending.empty())
+			wait = 0;
+		auto p = Gate2Modem.PopWaitFor(wait);
 		if (p)
 		{
 			if (not g_GateState.IsTxReady())
@@ -802,112 +1039,16 @@ void CCC1200::txProcess()
 			}
 			if (EPacketType::stream == p->GetType())
 			{
-				int8_t frame_symbols[SYM_PER_FRA];					// raw frame symbols
-				int8_t bsb_samples[963] = {CMD_TX_DATA, -61, 3};	// baseband samples wrapped in a frame
-
 				if (tx_state == ETxState::idle) // first received frame
 				{
-					pfn = p->GetFrameNumber();
-					if (p->IsLastPacket() or (pfn % 6))
-						continue;	// start a transmission at the beginning of a superframe
-					tx_state = ETxState::active;
-					usleep(10e3);
-					frame_count = 0; // we'll renumber each frame starting from zero
-					// now we'll make the LSF
-					memcpy(txlsf.GetData(), p->GetCDstAddress(), 12); // copy the dst & src
-					txType.SetFrameType(p->GetFrameType());           // get the TYPE
-					txType.SetMetaDataType(EMetaDatType::ecd);        // set the META to extended c/s data
-					// the next line will set the frame TYPE according to the configured user's radio
-					txlsf.SetFrameType(txType.GetFrameType(cfg.isV3 ? EVersionType::v3 : EVersionType::legacy));
-					auto meta = txlsf.GetMetaData();                  // save the address to the meta array
-					memcpy(meta, p->GetCSrcAddress(), 6);             // save the source address into slot 1
-					g_Gateway.GetLink().CodeOut(meta+6);              // put the linked reflect into slot 2
-					memset(meta+12, 0, 2);                            // zero the last 2 bytes
-					txlsf.CalcCRC();                                  // this LSF is done!
-
-					startTx();
-
-					//flush the RRC baseband filter
-					filterSymbols(nullptr, nullptr, nullptr, 0);
-				
-					//generate frame symbols, filter them and send out to the device
-					//we need to prepare 3 frames to begin the transmission - preamble, LSF and stream frame 0
-					//let's start with the preamble
-					uint32_t frame_buff_cnt=0;
-					gen_preamble_i8(frame_symbols, &frame_buff_cnt, PREAM_LSF);
-
-					//filter and send out to the device
-					filterSymbols(bsb_samples+3, frame_symbols, rrc_taps_5_poly, 0);
-					writeDev(bsb_samples, sizeof(bsb_samples), "SM Pream");
-
-					//now the LSF
-					gen_frame_i8(frame_symbols, nullptr, FRAME_LSF, (lsf_t *)(txlsf.GetCData()), 0, 0);
-
-					//filter and send out to the device
-					filterSymbols(bsb_samples+3, frame_symbols, rrc_taps_5_poly, 0);
-					writeDev(bsb_samples, sizeof(bsb_samples), "SM LSF");
-
-					//finally, the first frame
-					gen_frame_i8(frame_symbols, p->GetCPayload(), FRAME_STR, (const lsf_t *)(txlsf.GetCData()), 0, 0);
-
-					//filter and send out to the device
-					filterSymbols(bsb_samples+3, frame_symbols, rrc_taps_5_poly, 0);
-					writeDev(bsb_samples, sizeof(bsb_samples), "SM first Frame");
-					if (cfg.debug)
-					{
-						const CCallsign dst(txlsf.GetCDstAddress());
-						const CCallsign src(txlsf.GetCSrcAddress());
-						Log(EUnit::cc12, "GWY STR - DST: %s SRC: %s, TYPE: %04x FN: %04x\n", dst.c_str(), src.c_str(), txlsf.GetFrameType(), p->GetFrameNumber());
-					}
-				}
-				else
-				{
-					frame_count = (frame_count + 1u) & 0x7fffu;
-					if (0 == frame_count % 6u)
-					{
-						// make a LSF from the LSD in this packet
-						memcpy(txlsf.GetData(), p->GetCDstAddress(), 28);
-						txType.SetFrameType(p->GetFrameType());
-						p->SetFrameType(txType.GetFrameType(cfg.isV3 ? EVersionType::v3 : EVersionType::legacy));
-						txlsf.CalcCRC();
-					}
-					uint8_t lich_count = frame_count % 6u;
 					if (p->IsLastPacket())
-						frame_count |= 0x8000u;
-
-					//only one frame is needed
-					gen_frame_i8(frame_symbols, p->GetCPayload(), FRAME_STR, (lsf_t *)(txlsf.GetCData()), lich_count, frame_count);
-
-					//filter and send out to the device
-					filterSymbols(bsb_samples+3, frame_symbols, rrc_taps_5_poly, 0);
-					writeDev(bsb_samples, sizeof(bsb_samples), "SM Frame");
-					auto nextfn = p->GetFrameNumber();
-					if (cfg.debug and (++pfn != nextfn))
-					{
-						Log(EUnit::cc12, "GWY STR FN: %04x\n", nextfn);
-						pfn = nextfn;
-					}
+						continue;	// the end of a transmission we're not sending
+					jitter.Reset();
+					tx_state = ETxState::buffering;
+					tx_timer = getMS();
 				}
-
-				if (p->IsLastPacket()) //last stream frame
-				{
-					//send the final EOT marker
-					uint32_t frame_buff_cnt=0;
-					gen_eot_i8(frame_symbols, &frame_buff_cnt);
-
-					//filter and send out to the device
-					filterSymbols(bsb_samples+3, frame_symbols, rrc_taps_5_poly, 0);
-					writeDev(bsb_samples, sizeof(bsb_samples), "SM EOT");
-
-					usleep(8*40e3); //wait 320ms (8 M17 frames) - let the transmitter consume all the buffered samples
-
-					startRx();
-
-					g_GateState.Set2IdleIfGateIn();
-
-					tx_state = ETxState::idle;
-				}
-				tx_timer = getMS();
+				// the frames are sent from the jitter buffer, below
+				jitter.Push(p);
 			}
 
 			//M17 packet data - "Packet Mode IP Packet"
@@ -940,482 +1081,338 @@ void CCC1200::txProcess()
 					Log(EUnit::cc12, "└ MSG: %s\n", (char *)(p->GetPayload()+1));
 				}
 
-				//TODO: handle TX here
-				int8_t frame_symbols[SYM_PER_FRA];						//raw frame symbols
-				int8_t bsb_samples[SYM_PER_FRA*5];						//filtered baseband samples = symbols*sps
-				uint8_t bsb_chunk[963] = {CMD_TX_DATA, 0xC3, 0x03};		//baseband samples wrapped in a frame
-
-				startTx();
-				
-				//flush the RRC baseband filter
-				filterSymbols(nullptr, nullptr, nullptr, 0);
-				
-				//generate frame symbols, filter them and send out to the device
-				//we need to prepare 3 frames to begin the transmission - preamble, LSF and stream frame 0
-				//let's start with the preamble
-				uint32_t frame_buff_cnt = 0;
-				gen_preamble_i8(frame_symbols, &frame_buff_cnt, PREAM_LSF);
-				
-				//filter and send out to the device
-				filterSymbols(bsb_samples, frame_symbols, rrc_taps_5_poly, 0);
-				memcpy(&bsb_chunk[3], bsb_samples, sizeof(bsb_samples));
-				writeDev(bsb_samples, sizeof(bsb_samples), "PM LSF Pream");
-				
-				//now the LSF
-				gen_frame_i8(frame_symbols, nullptr, FRAME_LSF, (lsf_t*)(p->GetCDstAddress()), 0, 0);
-				
-				//filter and send out to the device
-				filterSymbols(bsb_samples, frame_symbols, rrc_taps_5_poly, 0);
-				memcpy(&bsb_chunk[3], bsb_samples, sizeof(bsb_samples));
-				writeDev(bsb_samples, sizeof(bsb_samples), "PM LSF");
-				
-				//packet frames
-				uint16_t pld_len = p->GetSize() - 34u;
-				uint8_t frame = 0;
-				uint8_t pld[26];
-				
-				while(pld_len > 25)
+				const uint16_t pld_len = p->GetSize() - 34u;
+				if (CM17Modulator::PacketFrames(pld_len) > TX_MAX_PACKET_FRAMES)
 				{
-					memcpy(pld, p->GetCPayload()+(frame*25), 25);
-					pld[25] = frame<<2;
-					gen_frame_i8(frame_symbols, pld, FRAME_PKT, nullptr, 0, 0);
-					filterSymbols(bsb_samples, frame_symbols, rrc_taps_5_poly, 0);
-					memcpy(&bsb_chunk[3], bsb_samples, sizeof(bsb_samples));
-					writeDev(bsb_samples, sizeof(bsb_samples), "PM Frame");
-					pld_len -= 25;
-					frame++;
-					usleep(40*1000U);
+					Log(EUnit::cc12, "A %u byte packet payload is too long to send\n", unsigned(pld_len));
+					if (ETxState::idle == tx_state and tx_pending.empty())
+						g_GateState.Set2IdleIfGateIn();
+					continue;
 				}
-				memset(pld, 0, 26);
-				memcpy(pld, p->GetCPayload()+(frame*25), pld_len);
-				pld[25] = (1<<7)  | (pld_len<<2); //EoT flag set, amount of remaining data in the 'frame number' field
-				gen_frame_i8(frame_symbols, pld, FRAME_PKT, nullptr, 0, 0);
-				filterSymbols(bsb_samples, frame_symbols, rrc_taps_5_poly, 0);
-				memcpy(&bsb_chunk[3], bsb_samples, sizeof(bsb_samples));
-				writeDev(bsb_samples, sizeof(bsb_samples), "PM Frame");
-				usleep(40*1000U);
-
-				//now the final EOT marker
-				frame_buff_cnt=0;
-				gen_eot_i8(frame_symbols, &frame_buff_cnt);
 
-				//filter and send out to the device
-				filterSymbols(bsb_samples, frame_symbols, rrc_taps_5_poly, 0);
-				memcpy(&bsb_chunk[3], bsb_samples, sizeof(bsb_samples));
-				writeDev(bsb_samples, sizeof(bsb_samples), "PM EOT");
-
-				usleep(3*40e3); //wait 120ms (3 M17 frames)
+				// it's modulated and sent below, with any others that are waiting
+				tx_pending.push(std::move(p));
+			}
+		}
 
-				startRx();
+		// key up once the jitter buffer has enough frames, or has waited as long as they would take
+		if (ETxState::buffering == tx_state and (jitter.IsReady() or (getMS() - tx_timer) > 40u * jitter.Target()))
+		{
+			bool concealed;
+			auto f = jitter.Pop(concealed);
+			tx_state = ETxState::active;
+			// we'll renumber the frames, but from where this one is in its superframe, so the LICH counters are right
+			frame_count = (f->GetFrameNumber() & 0x7fffu) % 6u;
+			hang = 0;
+			// now we'll make the LSF
+			memcpy(txlsf.GetData(), f->GetCDstAddress(), 12); // copy the dst & src
+			txType.SetFrameType(f->GetFrameType());           // get the TYPE
+			txType.SetMetaDataType(EMetaDatType::ecd);        // set the META to extended c/s data
+			// the next line will set the frame TYPE according to the configured user's radio
+			txlsf.SetFrameType(txType.GetFrameType(cfg.isV3 ? EVersionType::v3 : EVersionType::legacy));
+			auto meta = txlsf.GetMetaData();                  // save the address to the meta array
+			memcpy(meta, f->GetCSrcAddress(), 6);             // save the source address into slot 1
+			g_Gateway.GetLink().CodeOut(meta+6);              // put the linked reflect into slot 2
+			memset(meta+12, 0, 2);                            // zero the last 2 bytes
+			txlsf.CalcCRC();                                  // this LSF is done!
+
+			//we need 3 frames to begin the transmission - preamble, LSF and the first stream frame
+			//modulate them all before starting the transmitter, then send them out to the device
+			auto n = modulator.StreamStart(tx_bsb, txlsf, f->GetCPayload(), frame_count);
+			if (f->IsLastPacket())
+			{
+				modulator.EOT(tx_bsb + n * TX_BLOCK_LEN);
+				n++;
+			}
 
-				g_GateState.Set2IdleIfGateIn();
-				tx_timer = getMS();
+			startTx();
 
+			writeBsb(tx_bsb, n, "SM Start");
+			deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(40);
+			if (cfg.debug)
+			{
+				const CCallsign dst(txlsf.GetCDstAddress());
+				const CCallsign src(txlsf.GetCSrcAddress());
+				Log(EUnit::cc12, "GWY STR - DST: %s SRC: %s, TYPE: %04x FN: %04x, %u frames buffered\n", dst.c_str(), src.c_str(), txlsf.GetFrameType(), f->GetFrameNumber(), jitter.Depth() + 1u);
+			}
+			if (f->IsLastPacket()) // a one frame stream, the EOT has been sent
+			{
+				endStream();
 				tx_state = ETxState::idle;
 			}
 		}
-		//tx timeout
-		if ((tx_state == ETxState::active) and ((getMS()-tx_timer) > 240)) //240ms timeout
+
+		// a stream frame goes out every 40 ms, quiet if the jitter buffer doesn't have the next one
+		else if (ETxState::active == tx_state and std::chrono::steady_clock::now() >= deadline)
 		{
-			Log(EUnit::cc12, "TX timeout\n");
-			startRx();
+			deadline += std::chrono::milliseconds(40);
+			bool concealed;
+			auto f = jitter.Pop(concealed);
+			hang = concealed ? hang + 1u : 0u;
+			// if the gateway stops sending, end the transmission properly
+			const bool last = f->IsLastPacket() or hang >= TX_HANG_FRAMES;
+
+			frame_count = (frame_count + 1u) & 0x7fffu;
+			if (0 == frame_count % 6u)
+			{
+				// make a LSF from the LSD in this packet
+				memcpy(txlsf.GetData(), f->GetCDstAddress(), 28);
+				txType.SetFrameType(f->GetFrameType());
+				f->SetFrameType(txType.GetFrameType(cfg.isV3 ? EVersionType::v3 : EVersionType::legacy));
+				txlsf.CalcCRC();
+			}
 
-			g_GateState.Set2IdleIfGateIn();
-			//usleep(10*40e3); //wait 400ms (10 M17 frames)
+			//only one frame is needed, and the EOT if this is the last one
+			const auto n = modulator.Stream(tx_bsb, txlsf, f->GetCPayload(), 1, frame_count, last);
+			writeBsb(tx_bsb, n, "SM Frame");
 
-			tx_state=ETxState::idle;
+			if (last) //last stream frame, the EOT has been sent
+			{
+				if (not f->IsLastPacket())
+					Log(EUnit::cc12, "TX timeout, nothing from the gateway for %u ms\n", 40u * hang);
+				endStream();
+				tx_state = ETxState::idle;
+			}
 		}
-	}
-}
 
-void CCC1200::rxProcess()
-{
-	bool got_lsf = false;
-	uint8_t rx_bsb_sample = 0;
-	int8_t raw_bsb_rx[960];
-	uint8_t lsf_b[30];
-	bool first_frame = true;
-	uint16_t fn;
-	uint16_t last_fn = 0xffffu;
-	uint16_t sid;
-	uint16_t sample_cnt = 0;
-	RingBuffer<int8_t, 41> flt_buff;
-	RingBuffer<float, 2042> f_flt_buff;
-	// why 2042? 8*5+2*(8*5+4800/25*5)+2 = 2042
-	// 8 preamble symbols, 8 for the syncword, and 960 for the payload.
-	// floor(sps/2)=2 extra samples for timing error correction
-	const int8_t lsf_sync_ext[16] { +3, -3, +3, -3, +3, -3, +3, -3, +3, +3, +3, +3, -3, -3, +3, -3 };
-	const float escale = 4.14647334e-6f; // 100%/0xffff/SYM_PER_PLD/2
-	SLSF rxlsf;
-	CFrameType rxType;
-	ERxState rx_state = ERxState::idle;
-	// for stream mode
-	uint8_t lich_parts = 0;
-	// for packet mode
-	uint8_t pkt_pld[825];
-	uint8_t *ppkt = pkt_pld;
-	uint16_t plsize = 0;
-
-	struct pollfd pfd;
-	pfd.fd = fd;
-	pfd.events = POLLIN;
-	while (keep_running)
-	{
-		auto rv = poll(&pfd, 1, 40);
-		if (rv < 0)
+		// new radio settings wait until nothing is going out
+		if (retune_pending and ETxState::idle == tx_state and tx_pending.empty())
+			applyRetune();
+
+		// packets go out whenever a stream isn't, all of the ones waiting in one transmission
+		if (ETxState::idle == tx_state or ETxState::packet == tx_state)
 		{
-			keep_running = false;
-			if (EINTR == errno)
-				Log(EUnit::cc12, "Rx thread poll() interrupted, exiting\n");
-			else
-				Log(EUnit::cc12, "Rx thread poll() error: %s\n", strerror(errno));
-			raise(SIGINT);
-			return;
-		}
-		else if (rv == 0)
-			continue;
-		
-		if (pfd.revents != POLLIN) {
-			Log(EUnit::cc12, "Rx process thread poll() returned revents containing error: %d\n", pfd.revents);
-			raise(SIGINT);
-			return;
-		} else if ((not uart_lock) and g_GateState.IsRxReady()) {
-			if (readDev(&rx_bsb_sample, 1))
+			//modulate them before starting the transmitter
+			while (not tx_pending.empty() and queuePacket(*tx_pending.front(), ETxState::idle == tx_state))
 			{
-				raise(SIGINT);
-				return;
-			}
-
-			if (uart_sync) {
-				raw_bsb_rx[rx_buff_cnt++] = rx_bsb_sample;
-			} else {
-				rx_header.Push(rx_bsb_sample);
-				if (rx_header[0]==CMD_RX_DATA and rx_header[1]==0xC3 and rx_header[2]==0x03)
+				tx_pending.pop();
+				if (ETxState::idle == tx_state)
 				{
-					uart_sync = true;
-					rx_buff_cnt = 0;
-					rx_header.Clear();
+					jitter.Reset();
+					startTx();
+					tx_state = ETxState::packet;
+					deadline = std::chrono::steady_clock::now();
 				}
 			}
-			if (uart_sync and (rx_buff_cnt >= 960))
-			{
-				uart_rx_data_valid = true;
-				uart_sync = false;
-				rx_buff_cnt = 0;
-			}
-		}
 
-		if (uart_rx_data_valid)
-		{
-			// we can clear this right away
-			uart_rx_data_valid = false;
-			for (uint16_t ii=0; ii<960; ii++)
+			if (ETxState::packet == tx_state and std::chrono::steady_clock::now() >= deadline)
 			{
-				//push the next sample into the buffer
-				flt_buff.Push(raw_bsb_rx[ii]);
-
-				// filter the buffer to get the new sample
-				float f_sample = 0.0f;
-				for (uint8_t i=0; i<flt_buff.Size(); i++)
-					f_sample += rrc_taps_5[i] * float(flt_buff[i]);
-
-				// push the sample on into the float buffer
-				f_flt_buff.Push(f_sample*RX_SYMBOL_SCALING_COEFF);
-
-				//L2 norm check against syncword
-				float symbols[16];
-				for (uint8_t i=0; i<16; i++)
-					symbols[i]=f_flt_buff[i*5];
-				float sed_lsf = sed(symbols, lsf_sync_ext,    16);
-				float sed_sma = sed(symbols, str_sync_symbols, 8);
-				float sed_pma = sed(symbols, pkt_sync_symbols, 8);
-				for (uint8_t i=0; i<16; i++)
-					symbols[i]=f_flt_buff[960+i*5];
-				float sed_eot = sed(symbols, eot_symbols,      8);
-				float sed_smb = sed(symbols, str_sync_symbols, 8);
-				float sed_str = sed_sma + ((sed_smb < sed_eot) ? sed_smb : sed_eot);
-				float sed_pmb = sed(symbols, pkt_sync_symbols, 8);
-				float sed_pkt = sed_pma + ((sed_pmb < sed_eot) ? sed_pmb : sed_eot);
-
-				//LSF received at idle state
-				if ((sed_lsf <= 22.25f) and (rx_state == ERxState::idle))
+				const auto level = sendQueued(deadline);
+				// when nothing else is waiting and the device is almost done, finish with the EOT
+				if (tx_head == tx_tail and tx_pending.empty() and level <= TX_BLOCK_LEN)
 				{
-					//find minimum
-					uint8_t sample_offset = 0;
-					for (uint8_t i=1; i<=2; i++)
-					{
-						for (uint8_t j=0; j<16; j++)
-							symbols[j] = f_flt_buff[j*5+i];
+					tx_head = tx_tail = 0;
+					modulator.EOT(tx_bsb);
+					writeBsb(tx_bsb, 1, "PM EOT");
 
-						float d = sed(symbols, lsf_sync_ext, 16);
+					waitTxDone(3*40); //or wait 120ms (3 M17 frames)
 
-						if (d < sed_lsf)
-						{
-							sed_lsf = d;
-							sample_offset = i;
-						}
-					}
+					startRx();
 
-					float pld[SYM_PER_PLD];
+					g_GateState.Set2IdleIfGateIn();
 
-					for (uint16_t i=0; i<SYM_PER_PLD; i++)
-					{
-						pld[i]=f_flt_buff[16*5+i*5+sample_offset]; //add symbol timing correction
-					}
+					// a stream that came in meanwhile is still in the jitter buffer
+					tx_state = jitter.Depth() ? ETxState::buffering : ETxState::idle;
+					tx_timer = getMS();
+				}
+			}
+		}
+	}
+}
 
-					uint32_t e = decode_LSF((lsf_t*)(rxlsf.GetData()), pld);
+// Modulate a packet onto the end of the queue, after a preamble if it's the first in the transmission.
+// Returns false if there isn't room for it yet.
+bool CCC1200::queuePacket(CPacket &pkt, bool first)
+{
+	const uint16_t pld_len = pkt.GetSize() - 34u;
+	const unsigned need = CM17Modulator::PacketFrames(pld_len);
+	if (tx_head == tx_tail)
+		tx_head = tx_tail = 0;
+	else if (tx_tail + need > TX_QUEUE_FRAMES)
+	{
+		// move what's left to the front
+		memmove(tx_bsb, tx_bsb + tx_head * TX_BLOCK_LEN, (tx_tail - tx_head) * TX_BLOCK_LEN);
+		tx_tail -= tx_head;
+		tx_head = 0;
+	}
+	if (tx_tail + need > TX_QUEUE_FRAMES)
+		return false;
 
-					if (not rxlsf.CheckCRC()) //if CRC valid
-					{
-						if (g_GateState.TryState(EGateState::modemin))
-						{
-							got_lsf = true;
-							rxType.SetFrameType(rxlsf.GetFrameType());
-							rx_state = ((EPayloadType::packet == rxType.GetPayloadType()) ? ERxState::pkt : ERxState::str);
-							sample_cnt = 0;
-
-							const CCallsign dst(rxlsf.GetCDstAddress());
-							const CCallsign src(rxlsf.GetCSrcAddress());
-
-							Log(EUnit::cc12, "RF LSF DST: %s SRC: %s TYPE: %04X CAN: %d ED^2: %5.2f MER: %4.1f%%\n", dst.c_str(), src.c_str(), rxType.GetOriginType(), rxType.GetCan(), sed_lsf, float(e)*escale);
-
-							if (EPayloadType::packet != rxType.GetPayloadType()) //if stream
-							{
-								// init values for stream mode
-								fn = 0;
-								sid = g_RNG.Get();
-							}
-						} else if (cfg.debug)
-							Log(EUnit::cc12, "Could not obtain GateState modemin lock\n");
-					}
-				}
+	int8_t *out = tx_bsb + tx_tail * TX_BLOCK_LEN;
+	if (first)
+	{
+		modulator.Preamble(out);
+		out += TX_BLOCK_LEN;
+		tx_tail++;
+	}
+	const SLSF pktlsf(pkt.GetDstAddress());
+	tx_tail += modulator.PacketData(out, pktlsf, pkt.GetCPayload(), pld_len);
+	return true;
+}
 
-				//stream frame received
-				else if (sed_str <= 20.0f)
-				{
-					//find L2's minimum
-					uint8_t sample_offset=0;
-					for (uint8_t i=1; i<=2; i++)
-					{
-						for (uint8_t j=0; j<16; j++)
-							symbols[j]=f_flt_buff[j*5+i];
-						
-						float tmp_a = sed(symbols, str_sync_symbols, 8);
-						// check the next frame, look for another data frame or EOT frame
-						for (uint8_t j=0; j<16; j++)
-							symbols[j] = f_flt_buff[960+j*5+i];
-						float tmp_b = sed(symbols, str_sync_symbols, 8);
-						float tmp_e = sed(symbols, eot_symbols,      8);
-						float d = tmp_a + ((tmp_b < tmp_e) ? tmp_b : tmp_e);
-
-						if (d < sed_str)
-						{
-							sed_str = d;
-							sample_offset = i;
-						}
-					}
+// Write as many queued frames as the device has room for, and set the deadline to come back for more.
+// Returns how many samples the device still has to send, as far as we know.
+unsigned CCC1200::sendQueued(std::chrono::steady_clock::time_point &deadline)
+{
+	unsigned level = 0;
+	const bool noLevel = bsbLevel(level);
+	const auto now = std::chrono::steady_clock::now();
 
-					float pld[SYM_PER_PLD];
-					
-					for (uint16_t i=0; i<SYM_PER_PLD; i++)
-					{
-						pld[i]=f_flt_buff[40+i*5+sample_offset];
-					}
+	if (noLevel)
+	{
+		// one frame every 40 ms, but the preamble and LSF go together
+		const unsigned n = std::min(tx_head ? 1u : 2u, tx_tail - tx_head);
+		writeBsb(tx_bsb + tx_head * TX_BLOCK_LEN, n, "PM Frame");
+		tx_head += n;
+		deadline = now + std::chrono::milliseconds(40);
+		return n ? TX_BLOCK_LEN + 1u : 0u;
+	}
 
-					uint8_t lich[6];
-					uint8_t lich_cnt;
-					uint8_t frame_data[16];
-					uint32_t e = decode_str_frame(frame_data, lich, &fn, &lich_cnt, pld);
-					if (0 == lich_cnt)
-						lich_parts = 0;
-					uint16_t frame_count = fn & 0x7fffu;
-					if (first_frame) {
-						last_fn = frame_count - 1;
-						first_frame = false;
-					}
-					
-					if (((last_fn + 1u) & 0x7fffu) == frame_count)
-					{
-						if (got_lsf) // send this data frame to the gateway
-						{
-							sample_cnt = 0;
-							auto p = std::make_unique<CPacket>();
-							p->Initialize(EPacketType::stream);
-							p->SetStreamId(sid);
-							memcpy(p->GetDstAddress(), rxlsf.GetCData(), 28);
-							p->SetFrameNumber(fn);
-							memcpy(p->GetPayload(), frame_data, 16);
-							p->CalcCRC();
-							if (g_GateState.TryState(EGateState::modemin))
-								Modem2Gate.Push(p);
-
-							if ((cfg.debug and (fn%12u==11u)) or (fn>>15))
-							{
-								Log(EUnit::cc12, "RF Stream Frame: FN:%04X ED^2:%5.2f MER:%4.1f%%\n", fn, sed_str, float(e)*escale);
-							}
-						}
+	if (level <= TX_BSB_HIGH_WATER)
+	{
+		const unsigned n = std::min((TX_BSB_HIGH_WATER - level) / TX_BLOCK_LEN + 1u, tx_tail - tx_head);
+		writeBsb(tx_bsb + tx_head * TX_BLOCK_LEN, n, "PM Frame");
+		tx_head += n;
+		level += n * TX_BLOCK_LEN;
+	}
 
-						if (lich_parts != 0x3fu) // if the lich data is not complete
-						{
-							//reconstruct LSF chunk by chunk
-							memcpy(lsf_b+(5u*lich_cnt), lich, 5); //40 bits
-							lich_parts |= (1<<lich_cnt);
-							if (0x3fu == lich_parts) //collected all of them?
-							{
-								if (g_Crc.CheckCRC(lsf_b, 30)) {
-									if (cfg.debug)
-									{
-										Log(EUnit::cc12, "LICH LSF: CRC Error\n");
-										Dump(nullptr, lsf_b, 30);
-									}
-								} else {
-									memcpy(rxlsf.GetData(), lsf_b, 30);
-									if (not got_lsf)
-									{
-										rxType.SetFrameType(rxlsf.GetFrameType());
-										if (g_GateState.TryState(EGateState::modemin))
-										{
-											rx_state = ((EPayloadType::packet == rxType.GetPayloadType()) ? ERxState::pkt : ERxState::str); // the LICH
-											sample_cnt = 0; // LICH LSF
-											got_lsf = true;
-											sid = g_RNG.Get();
-											const CCallsign dst(rxlsf.GetCDstAddress());
-											const CCallsign src(rxlsf.GetCSrcAddress());
-											Log(EUnit::cc12, "LICH LSF: DST: %s SRC: %s TYPE: %04X CAN: %d\n", dst.c_str(), src.c_str(), rxlsf.GetFrameType(), rxType.GetCan());
-										} else {
-											Log(EUnit::cc12, "Got LICH LSF, but could not obtain GateLock\n");
-											Dump(nullptr, lsf_b, 30);
-										}
-									}
-								}
-								lich_parts = 0;
-							}
-						}
-						last_fn = fn;
-					}
+	// come back when it's down to the mark, or down to the last frame if it's time for the EOT
+	const unsigned mark = (tx_head == tx_tail) ? TX_BLOCK_LEN : TX_BSB_HIGH_WATER;
+	const unsigned excess = (level > mark) ? level - mark : 0u;
+	deadline = now + std::chrono::microseconds(std::max(TX_BSB_MIN_POLL_US, excess * 125u / 3u));
+	return level;
+}
 
-					if (fn >> 15) // is this the last frame?
-					{
-						// this is the last packet
-						rx_state = ERxState::idle; // last stream frame
-						got_lsf = false;
-						lich_parts = 0;
-						last_fn = 0xfffu;
-						first_frame = true;
-					}
-				}
+// after the EOT of a stream, go back to receiving
+void CCC1200::endStream()
+{
+	waitTxDone(8*40); //let the transmitter consume all the buffered samples, or wait 320ms (8 M17 frames)
 
-				//TODO: handle packet mode reception over RF
-				else if ((sed_pkt <= 25.0f) and (rx_state == ERxState::pkt))
-				{
-					//find L2's minimum
-					uint8_t sample_offset = 0;
-					for (uint8_t i=1; i<=2; i++)
-					{
-						for (uint8_t j=0; j<8; j++)
-							symbols[j]=f_flt_buff[j*5+i];
-							
-						float tmp_a = sed(symbols, pkt_sync_symbols, 8);
-						for (uint8_t j=0; j<16; j++)
-							symbols[j] = f_flt_buff[960+j*5+i];
-						float tmp_b = sed(symbols, pkt_sync_symbols, 8);
-						float tmp_c = sed(symbols, eot_symbols, 8);
-						float d = tmp_a + ((tmp_c > tmp_b) ? tmp_b : tmp_c);
-
-						if (d < sed_pkt)
-						{
-							sed_pkt = d;
-							sample_offset = i;
-						}
-					}
+	startRx();
 
-					float pld[SYM_PER_PLD];
-					for (uint16_t i=0; i<SYM_PER_PLD; i++)
-					{
-						pld[i]=f_flt_buff[8*5+i*5+sample_offset];
-					}
+	g_GateState.Set2IdleIfGateIn();
 
-					uint8_t eof, pkt_fn;
-					uint32_t e = decode_pkt_frame(ppkt, &eof, &pkt_fn, pld);
-					sample_cnt = 0;
+	const auto &js = jitter.GetStats();
+	if (cfg.debug or js.lost or js.late or js.stretched or js.overflows)
+		Log(EUnit::cc12, "TX jitter buffer: %u frames, %u lost, %u late, %u stretched, %u dropped, %u duplicates, depth %u max, %u target\n", js.frames, js.lost, js.late, js.stretched, js.overflows, js.duplicates, js.maxDepth, jitter.Target());
+}
 
-					if (cfg.debug) Log(EUnit::cc12, "RF PacketFrame: EOF: %s FN: %u d^2:%5.2f MER: %4.1f\n", (eof ? "true " : "false"), unsigned(pkt_fn), sed_pkt, e*escale);
+// The reader stage of the receiver, called from the event loop whenever the UART has something for us:
+// it only drains the UART and parses out the blocks of samples, which are passed to the demodulator,
+// rxProcess(), on another thread. The loop is shared with the gateway's sockets and timers, so a busy
+// gateway callback delays it, that's why the gateway does its database and file work on a worker.
+// It's the only reader of the UART, the replies to commands it finds are handed to the waiting requests.
+void CCC1200::rxRead(uint32_t events)
+{
+	uint8_t rx_uart_buf[4096];
 
-					// increment size and pointer
-					plsize += eof ? pkt_fn : 25;
-					ppkt += 25;
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		Log(EUnit::cc12, "%s returned error events: 0x%x\n", cfg.uartDev.c_str(), events);
+		g_EventLoop.Remove(fd);
+		raise(SIGINT);
+		return;
+	}
 
-					if(eof)
-					{
-						if (g_Crc.CheckCRC(pkt_pld, plsize))
-						{
-							Log(EUnit::cc12, "RF PKT: Payload CRC failed\n");
-							Dump(nullptr, pkt_pld, plsize);
-						} else {
-							if (got_lsf)
-							{
-								if (g_GateState.TryState(EGateState::modemin)) {
-									auto pkt = std::make_unique<CPacket>();
-									pkt->Initialize(EPacketType::packet, plsize+34);
-									memcpy(pkt->GetData()+4, rxlsf.GetCData(), 30);
-									memcpy(pkt->GetData()+34, pkt_pld, plsize);
-									// crc will be calulated by the gateway
-									Modem2Gate.Push(pkt);
-								}
-							} else {
-								Log(EUnit::cc12, "Got a Packet Payload, but not the LSF!");
-							}
-							if (cfg.debug) {
-								if (0x5u == *pkt_pld and 0u == pkt_pld[plsize-3]) {
-									Log(EUnit::cc12, "RF SMS Msg: %s", (char *)(pkt_pld+1));
-								} else {
-									Log(EUnit::cc12, "Packet Payload:\n");
-									Dump(nullptr, pkt_pld, plsize);
-								}
-							}
-						}
-					}
-				}
-				
-				//RX sync timeout
-				if (rx_state != ERxState::idle)
-				{
-					sample_cnt++;
-					if (960*2 <= sample_cnt) // 80 ms without detecting anything in the sync'ed state
-					{
-						Log(EUnit::cc12, "RF Timeout\n");
-						rx_state = ERxState::idle; // timeout
-						g_GateState.SetStateToOnlyIfFrom(EGateState::rftimeout, EGateState::modemin);
-						got_lsf = false;
-						sample_cnt = 0;
-						// stream mode reset
-						lich_parts = 0;
-						last_fn = 0xffffu;
-						// packet mode reset
-						ppkt = pkt_pld;
-					}
-				}
+	// drain everything the UART has for us with a single read()
+	auto r = read(fd, rx_uart_buf, sizeof(rx_uart_buf));
+	if (r <= 0)
+	{
+		if (r < 0 and (EAGAIN == errno or EINTR == errno))
+			return;
+		if (r < 0)
+			Log(EUnit::cc12, "read() %s returned error: %s\n", cfg.uartDev.c_str(), strerror(errno));
+		else
+			Log(EUnit::cc12, "read() %s returned zero bytes\n", cfg.uartDev.c_str());
+		g_EventLoop.Remove(fd);
+		raise(SIGINT);
+		return;
+	}
+
+	for (size_t pos = 0; pos < size_t(r); )
+	{
+		pos += parseRx(rx_uart_buf + pos, r - pos);
+
+		// the UART is always read, for the command replies, but the samples are only used when we can receive
+		if (uart_rx_data_valid)
+		{
+			uart_rx_data_valid = false;
+			if (not g_GateState.IsRxReady())
+				continue;
+			capture.Write(raw_bsb_rx);
+			auto blk = rx_blocks.Back();
+			if (blk)
+			{
+				memcpy(blk->data(), raw_bsb_rx, RX_BLOCK_LEN);
+				rx_blocks.Push();
 			}
+			else if (0u == rx_overruns++ % 25u)
+				Log(EUnit::cc12, "Rx demodulator is falling behind, %u sample blocks dropped\n", rx_overruns);
 		}
 	}
 }
 
-/**
- * @brief Calculate squared Euclidean distance between two n-dimensional vectors.
- * It is the sum of squared differences.
- *
- * @param v1 Vector 1 - floats.
- * @param v2 Vector 2 - signed ints.
- * @param n Vectors' size.
- * @return float Squared distance between two points.
- */
-float CCC1200::sed(const float *v1, const int8_t *v2, const unsigned n) const
+void CCC1200::pinThread(int core, const char *name)
 {
-	float r = 0.0f;
-	for (unsigned i=0; i<n; i++)
+	if (core < 0)
+		return;
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(core, &cpus);
+	auto rv = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (rv)
+		Log(EUnit::cc12, "Could not pin the %s thread to core %d: %s\n", name, core, strerror(rv));
+	else
+		Log(EUnit::cc12, "%s thread is pinned to core %d\n", name, core);
+}
+
+void CCC1200::rxProcess()
+{
+	demod.SetDebug(cfg.debug);
+	demod.SetLSFCallback([this](const SLSF &) {
+		if (not g_GateState.TryState(EGateState::modemin))
+		{
+			if (cfg.debug)
+				Log(EUnit::cc12, "Could not obtain GateState modemin lock\n");
+			return false;
+		}
+		rx_sid = g_RNG.Get();
+		return true;
+	});
+	demod.SetStreamCallback([this](const SLSF &lsf, uint16_t fn, const uint8_t *payload) {
+		auto p = std::make_unique<CPacket>();
+		p->Initialize(EPacketType::stream);
+		p->SetStreamId(rx_sid);
+		memcpy(p->GetDstAddress(), lsf.GetCData(), 28);
+		p->SetFrameNumber(fn);
+		memcpy(p->GetPayload(), payload, 16);
+		p->CalcCRC();
+		if (g_GateState.TryState(EGateState::modemin))
+			Modem2Gate.Push(p);
+	});
+	demod.SetPacketCallback([](const SLSF &lsf, const uint8_t *payload, uint16_t size) {
+		if (g_GateState.TryState(EGateState::modemin)) {
+			auto pkt = std::make_unique<CPacket>();
+			pkt->Initialize(EPacketType::packet, size+34);
+			memcpy(pkt->GetData()+4, lsf.GetCData(), 30);
+			memcpy(pkt->GetData()+34, payload, size);
+			// crc will be calulated by the gateway
+			Modem2Gate.Push(pkt);
+		}
+	});
+	demod.SetTimeoutCallback([]() {
+		g_GateState.SetStateToOnlyIfFrom(EGateState::rftimeout, EGateState::modemin);
+	});
+
+	pinThread(cfg.rxDemodCore, "Rx demodulator");
+	while (keep_running)
 	{
-		auto x = v1[i] - float(v2[i]);
-		r += x * x;
+		// sleep until the reader has a block for us
+		const auto blk = rx_blocks.WaitFor(40) ? rx_blocks.Front() : nullptr;
+		if (blk)
+		{
+			demod.Process(blk->data());
+			rx_blocks.Pop();
+		}
 	}
-	return r;
 }
@@ -19,21 +19,48 @@
 #pragma once
 
 #include <future>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <array>
 #include <cstdint>
 #include <string>
 #include <termios.h>
 #include <unistd.h>
 #include <gpiod.h>
 
+#include "CC1200Cmds.h"
 #include "RingBuffer.h"
+#include "SpscQueue.h"
+#include "M17Demodulator.h"
+#include "M17Modulator.h"
+#include "Capture.h"
+#include "JitterBuffer.h"
 #include "FrameType.h"
 #include "Callsign.h"
 #include "Base.h"
 #include "LSF.h"
 
-enum class ERxState { idle, str, pkt };
+class CConfigure;
 
-enum class ETxState { idle, active };
+enum class ETxState { idle, buffering, active, packet };
+
+// TX flow control, the device's baseband buffer level is in samples, 24 per ms
+#define TX_BSB_HIGH_WATER (2*TX_BLOCK_LEN)	// don't send another packet frame until the buffer is down to this
+#define TX_QUEUE_FRAMES (2*TX_MAX_PACKET_FRAMES)	// modulated packet frames waiting to be sent
+#define TX_BSB_MIN_POLL_US 2000u			// the shortest wait between buffer queries
+#define TX_BSB_MAX_MISSES 3u				// unanswered buffer queries in a row before TX uses fixed waits
+#define TXRX_RETRY_US 5000u				// wait this long before retrying a failed TX/RX start or stop
+#define CMD_TIMEOUT_MS 250u				// how long to wait for the reply to a command
+#define CMD_REPLY_MAX 1024u				// the longest reply frame the parser will take
+#define TX_HANG_FRAMES 12				// end a stream transmission after this many quiet frames in a row
+#define NRST_PULSE_US 10000u				// how long the device is held in reset at start-up
+#define READY_PING_MS 20u				// the PING timeout while waiting for the device to boot
+#define DEV_BOOT_MS 3000u				// give up if the device hasn't answered a PING by then
+
+enum class ERxParse { cmd, lenlo, lenhi, payload };
 
 using SConfig = struct config_tag
 {
@@ -45,30 +72,32 @@ using SConfig = struct config_tag
 	int freqCorr;
 	float power;
 	bool afc, isV3, debug;
+	int rxDemodCore;
+	std::string captureFolder;
+	unsigned captureFileSize, captureFiles;
+	unsigned txJitterDepth, txJitterMaxDepth;
 };
 
-enum err_t
-{
-	ERR_OK,					//all good
-	ERR_TRX_PLL,			//TRX PLL lock error
-	ERR_TRX_SPI,			//TRX SPI comms error
-	ERR_RANGE,				//value out of range
-	ERR_CMD_MALFORM,		//malformed command
-	ERR_BUSY,				//busy!
-	ERR_BUFF_FULL,			//buffer full
-	ERR_NOP,				//nothing to do
-	ERR_OTHER
-};
+// one CMD_RX_DATA frame of baseband samples
+using SRxBlock = std::array<int8_t, RX_BLOCK_LEN>;
+// a reply from the device, the whole frame
+using SReply = std::vector<uint8_t>;
 
 class CCC1200 : public CBase
 {
 public:
 	bool Start();
 	void Stop();
+	// Take the radio settings from a freshly read ini file, they're applied between transmissions.
+	// Only RXFrequency, TXFrequency, FreqCorrection, TXPower and AFC can be changed this way.
+	void Retune(const CConfigure &newcfg);
 
 private:
 	void rxProcess(void);
+	void rxRead(uint32_t events);
+	void pinThread(int core, const char *name);
 	void txProcess(void);
+	void endStream(void);
 	bool loadConfig(void);
 	uint32_t getMS(void);
 	speed_t getBaud(unsigned baud);
@@ -77,25 +106,39 @@ private:
 	bool gpioSetValue(unsigned offset, int value);
 	bool gpioInit(const std::string &consumer);
 	void gpioCleanup(void);
-	bool readDev(void *buf, int size);
-	void writeDev(void *buf, int size, const char *where);
+	void writeDev(const void *buf, int size, const char *where);
+	std::future<SReply> request(const uint8_t *cmd, size_t size, const char *what);
+	bool command(const uint8_t *cmd, size_t size, SReply &reply, const char *what, unsigned timeout_ms = CMD_TIMEOUT_MS);
+	bool command(const uint8_t *cmd, size_t size, uint8_t *resp, size_t rsize, const char *what, unsigned timeout_ms = CMD_TIMEOUT_MS);
+	void deliver(SReply &reply);
+	bool isExpected(uint8_t cid);
+	void writeBsb(const int8_t *samples, unsigned frames, const char *where);
 	bool getFwVersion();
+	bool getBsbBuff(unsigned &level);
+	bool bsbLevel(unsigned &level);
+	void waitTxDone(unsigned fixed_ms);
+	bool queuePacket(CPacket &pkt, bool first);
+	unsigned sendQueued(std::chrono::steady_clock::time_point &deadline);
 	bool pingDev(void);
+	bool waitReady(unsigned &pings);
 	bool setRxFreq(uint32_t freq);
 	bool setTxFreq(uint32_t freq);
 	bool setFreqCorr(int16_t corr);
 	bool setAfc(bool afc);
 	bool setTxPower(float pow);
 	err_t txrxControl(uint8_t cid, uint8_t onoff, const char *what);
+	size_t parseRx(const uint8_t *buf, size_t size);
 	void startTx(void);
 	void startRx(void);
-	void reset_rx(void);
-	float sed(const float *v1, const int8_t *v2, const unsigned len) const;
-	void filterSymbols(int8_t* __restrict out, const int8_t* __restrict in, const float* __restrict flt, uint8_t phase_inv);
+	void applyRetune(void);
 
 	int fd = -1; // the handle to the CC1200 uart
 
 	SConfig cfg;
+	// the radio settings from Retune(), waiting for txProcess to apply them
+	std::mutex retune_mtx;
+	SConfig retune_cfg;
+	std::atomic<bool> retune_pending { false };
 
 	// gpiod pointers
 	struct gpiod_chip *gpio_chip = nullptr;
@@ -103,10 +146,37 @@ private:
 	struct gpiod_line_request *nrst_line = nullptr;
 
 	std::atomic<bool> keep_running;
-	std::atomic<bool> uart_lock = false;
+	// cleared after TX_BSB_MAX_MISSES unanswered CMD_GET_BSB_BUFF in a row, then TX uses fixed waits,
+	// it's tried again on the next transmission, unless the device has never answered it
+	bool bsb_buff_ok = true, bsb_buff_seen = false;
+	unsigned bsb_buff_misses = 0;
 	bool uart_rx_data_valid = false;
 	uint16_t rx_buff_cnt = 0;
-	bool uart_sync = false;
-	RingBuffer<uint8_t, 3> rx_header;
+	unsigned rx_overruns = 0;
+	ERxParse rx_parse = ERxParse::cmd;
+	// the frame being parsed, and if it's not baseband, the reply so far
+	uint8_t rx_cmd = 0;
+	uint16_t rx_len = 0;
+	SReply rx_reply;
+	// rxRead() is the only reader of the UART, the replies it finds go to the requests waiting here
+	std::mutex cmd_mtx, write_mtx;
+	std::map<uint8_t, std::promise<SReply>> pending;
+	int8_t raw_bsb_rx[960];
+	// 16 blocks is 640 ms of samples between the reader and the demodulator
+	CSpscQueue<SRxBlock, 16> rx_blocks;
+	// the demodulator runs in rxProcess, rx_sid is the stream id of what it's receiving
+	CM17Demodulator demod;
+	uint16_t rx_sid = 0;
+	// the modulator and its output, used by txProcess, packet frames wait here
+	// from tx_head to tx_tail until the device has room for them
+	CM17Modulator modulator;
+	int8_t tx_bsb[TX_QUEUE_FRAMES * TX_BLOCK_LEN];
+	unsigned tx_head = 0, tx_tail = 0;
+	// packets from the gateway that aren't modulated yet
+	std::queue<std::unique_ptr<CPacket>> tx_pending;
+	// stream frames from the gateway wait here, so they go out evenly and in order
+	CJitterBuffer jitter;
+	// the optional baseband capture, fed by rxRead
+	CCaptureWriter capture;
 	std::future<void> txFuture, rxFuture;
 };
@@ -0,0 +1,66 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// The CC1200 HAT firmware's UART protocol, shared by mspot and cc1200-sim.
+// Every frame is a command id, the little-endian frame length, including
+// these 3 bytes, and then the rest of the frame.
+
+//CC1200 commands
+enum cmd_t
+{
+	CMD_PING,
+
+	//SET
+	CMD_SET_RX_FREQ,
+	CMD_SET_TX_FREQ,
+	CMD_SET_TX_POWER,
+	CMD_SET_RESERVED,
+	CMD_SET_FREQ_CORR,
+	CMD_SET_AFC,
+	CMD_TX_START,
+	CMD_RX_START,
+	CMD_RX_DATA,
+	CMD_TX_DATA,
+	CMD_DBG_ENABLE,
+	CMD_DBG_TXT,
+
+	//GET
+	CMD_GET_IDENT = 0x80,
+	CMD_GET_CAPS,
+	CMD_GET_RX_FREQ,
+	CMD_GET_TX_FREQ,
+	CMD_GET_TX_POWER,
+	CMD_GET_FREQ_CORR,
+	CMD_GET_BSB_BUFF,
+	CMD_GET_RSSI
+};
+
+enum err_t
+{
+	ERR_OK,					//all good
+	ERR_TRX_PLL,			//TRX PLL lock error
+	ERR_TRX_SPI,			//TRX SPI comms error
+	ERR_RANGE,				//value out of range
+	ERR_CMD_MALFORM,		//malformed command
+	ERR_BUSY,				//busy!
+	ERR_BUFF_FULL,			//buffer full
+	ERR_NOP,				//nothing to do
+	ERR_OTHER
+};
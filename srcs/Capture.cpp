@@ -0,0 +1,240 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include "Capture.h"
+
+using SCaptureHeader = struct capture_header_tag
+{
+	char magic[8];
+	uint32_t version, sampleRate;
+};
+
+static const SCaptureHeader capture_header { { 'M', 'S', 'P', 'O', 'T', 'C', 'A', 'P' }, CAPTURE_VERSION, 24000u };
+
+bool CCaptureWriter::Start(const std::string &dir, unsigned fileMB, unsigned fileCount)
+{
+	folder = dir;
+	maxSize = uint64_t(fileMB) << 20;
+	maxFiles = fileCount;
+	dropped = 0;
+	if (openFile())
+		return true;
+	keep_running = true;
+	writeFuture = std::async(std::launch::async, &CCaptureWriter::writeProcess, this);
+	if (not writeFuture.valid())
+	{
+		Log(EUnit::cc12, "Could not start the capture writer thread\n");
+		keep_running = false;
+		fclose(fp);
+		fp = nullptr;
+		return true;
+	}
+	Log(EUnit::cc12, "Capturing Rx baseband in %s\n", folder.c_str());
+	return false;
+}
+
+void CCaptureWriter::Stop()
+{
+	if (not keep_running)
+		return;
+	keep_running = false;
+	if (writeFuture.valid())
+		writeFuture.get();
+	if (dropped)
+		Log(EUnit::cc12, "The capture writer dropped %u sample blocks\n", dropped);
+}
+
+void CCaptureWriter::Write(const int8_t *samples)
+{
+	if (not keep_running)
+		return;
+	auto rec = queue.Back();
+	if (nullptr == rec)
+	{
+		dropped++;
+		return;
+	}
+	rec->ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	memcpy(rec->samples, samples, RX_BLOCK_LEN);
+	queue.Push();
+}
+
+void CCaptureWriter::writeProcess()
+{
+	// keep going until everything that was queued before Stop() is on the disk
+	while (keep_running or queue.Count())
+	{
+		if (not queue.WaitFor(40))
+		{
+			// idle, so this is a good time to push what we have to the disk
+			if (fp)
+				fflush(fp);
+			continue;
+		}
+		const auto rec = queue.Front();
+		if (fp and fileSize + sizeof(SCaptureRecord) > maxSize)
+		{
+			fclose(fp);
+			fp = nullptr;
+			openFile();
+		}
+		if (fp)
+		{
+			if (1 == fwrite(rec, sizeof(SCaptureRecord), 1, fp))
+				fileSize += sizeof(SCaptureRecord);
+			else
+			{
+				Log(EUnit::cc12, "Capture write error: %s, capturing is stopped\n", strerror(errno));
+				fclose(fp);
+				fp = nullptr;
+			}
+		}
+		queue.Pop();
+	}
+	if (fp)
+	{
+		fclose(fp);
+		fp = nullptr;
+	}
+}
+
+// open a new capture file named for the current time, returns true on error
+bool CCaptureWriter::openFile()
+{
+	const auto now = std::chrono::system_clock::now();
+	const auto t = std::chrono::system_clock::to_time_t(now);
+	const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+	struct tm tm;
+	localtime_r(&t, &tm);
+	char stamp[96];
+	snprintf(stamp, sizeof(stamp), "mspot-%04d%02d%02d-%02d%02d%02d.%03d", tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, int(ms));
+
+	// a rotation in the same millisecond gets a sequence number, "_NN" still sorts after the first
+	std::string path;
+	for (unsigned seq=0; nullptr == fp and seq<100u; seq++)
+	{
+		char name[128];
+		if (seq)
+			snprintf(name, sizeof(name), "%s_%02u.cap", stamp, seq);
+		else
+			snprintf(name, sizeof(name), "%s.cap", stamp);
+		path = (std::filesystem::path(folder) / name).string();
+		fp = fopen(path.c_str(), "wbx");
+		if (nullptr == fp and EEXIST != errno)
+			break;
+	}
+	if (nullptr == fp)
+	{
+		Log(EUnit::cc12, "Could not open capture file %s: %s\n", path.c_str(), strerror(errno));
+		return true;
+	}
+	if (1 != fwrite(&capture_header, sizeof(capture_header), 1, fp))
+	{
+		Log(EUnit::cc12, "Could not write the header of %s: %s\n", path.c_str(), strerror(errno));
+		fclose(fp);
+		fp = nullptr;
+		return true;
+	}
+	fileSize = sizeof(capture_header);
+	removeOldFiles();
+	return false;
+}
+
+// only keep the newest maxFiles capture files, the names sort by time
+void CCaptureWriter::removeOldFiles()
+{
+	std::vector<std::filesystem::path> files;
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::directory_iterator(folder, ec))
+	{
+		const auto name = entry.path().filename().string();
+		if (0 == name.compare(0, 6, "mspot-") and entry.path().extension() == ".cap")
+			files.push_back(entry.path());
+	}
+	if (files.size() <= maxFiles)
+		return;
+	std::sort(files.begin(), files.end());
+	for (size_t i=0; i<files.size()-maxFiles; i++)
+	{
+		if (not std::filesystem::remove(files[i], ec))
+			Log(EUnit::cc12, "Could not remove old capture file %s: %s\n", files[i].c_str(), ec.message().c_str());
+	}
+}
+
+bool CCaptureReader::Open(const std::string &path)
+{
+	Close();
+	fp = fopen(path.c_str(), "rb");
+	if (nullptr == fp)
+	{
+		Log(EUnit::cc12, "Could not open %s: %s\n", path.c_str(), strerror(errno));
+		return true;
+	}
+	SCaptureHeader header;
+	if (1 == fread(&header, sizeof(header), 1, fp) and 0 == memcmp(header.magic, capture_header.magic, sizeof(header.magic)))
+	{
+		if (CAPTURE_VERSION != header.version)
+		{
+			Log(EUnit::cc12, "%s is a version %u capture file, version %u was expected\n", path.c_str(), header.version, CAPTURE_VERSION);
+			Close();
+			return true;
+		}
+		raw = false;
+	}
+	else
+	{
+		// no header, so these are just samples
+		rewind(fp);
+		raw = true;
+	}
+	blocks = 0;
+	return false;
+}
+
+bool CCaptureReader::Read(SCaptureRecord &rec)
+{
+	if (nullptr == fp)
+		return false;
+	if (raw)
+	{
+		if (1 != fread(rec.samples, RX_BLOCK_LEN, 1, fp))
+			return false;
+		rec.ns = blocks * 40000000u; // 40 ms per block
+	}
+	else if (1 != fread(&rec, sizeof(SCaptureRecord), 1, fp))
+		return false;
+	blocks++;
+	return true;
+}
+
+void CCaptureReader::Close()
+{
+	if (fp)
+	{
+		fclose(fp);
+		fp = nullptr;
+	}
+}
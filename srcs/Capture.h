@@ -0,0 +1,90 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <future>
+
+#include "SpscQueue.h"
+#include "RxFilter.h"
+#include "Base.h"
+
+// A capture file is a 16 byte header followed by fixed size records, in host byte order (little-endian on a Pi):
+//   header: "MSPOTCAP", uint32 version (1), uint32 sample rate (24000)
+//   record: uint64 monotonic time in ns when the block arrived, then RX_BLOCK_LEN int8 samples
+// Files are only ever appended to, so a partial record at the end (from a crash) is just ignored.
+#define CAPTURE_VERSION 1u
+
+using SCaptureRecord = struct capture_record_tag
+{
+	uint64_t ns;
+	int8_t samples[RX_BLOCK_LEN];
+};
+static_assert(sizeof(SCaptureRecord) == 8 + RX_BLOCK_LEN, "SCaptureRecord must not be padded");
+
+// Writes every CMD_RX_DATA block it's given into a folder of rotating capture files.
+// Write() only copies the block into a queue, a background thread does all the file I/O,
+// so the Rx reader never waits on the disk. If the disk can't keep up, blocks are dropped.
+class CCaptureWriter : public CBase
+{
+public:
+	~CCaptureWriter() { Stop(); }
+	// start the writer thread, returns true on error
+	bool Start(const std::string &folder, unsigned fileMB, unsigned fileCount);
+	void Stop();
+	// called from the Rx reader thread, never blocks
+	void Write(const int8_t *samples);
+
+private:
+	void writeProcess();
+	bool openFile();
+	void removeOldFiles();
+
+	CSpscQueue<SCaptureRecord, 32> queue; // 1.28 s of samples
+	std::atomic<bool> keep_running = false;
+	std::future<void> writeFuture;
+	std::string folder;
+	uint64_t maxSize = 0;
+	unsigned maxFiles = 0;
+	FILE *fp = nullptr;
+	uint64_t fileSize = 0;
+	unsigned dropped = 0; // only touched by the producer
+};
+
+// Reads the records of a capture file back, in order. Open() also accepts a file of plain
+// int8 samples, and then makes up the time stamps from the sample count.
+class CCaptureReader : public CBase
+{
+public:
+	~CCaptureReader() { Close(); }
+	// returns true on error
+	bool Open(const std::string &path);
+	// returns false at the end of the file
+	bool Read(SCaptureRecord &rec);
+	void Close();
+	bool IsRaw() const { return raw; }
+
+private:
+	FILE *fp = nullptr;
+	bool raw = false;
+	uint64_t blocks = 0;
+};
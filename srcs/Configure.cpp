@@ -158,6 +158,20 @@ bool CConfigure::ReadData(const std::string &path)
 					data[g_Keys.modem.section][g_Keys.modem.txPower] = getFloat(value, "Transmit Power (dBm)", -20.0f, 10.0f, 10.0f);
 				else if (0 == key.compare(g_Keys.modem.debug))
 					data[g_Keys.modem.section][g_Keys.modem.debug] = IS_TRUE(value[0]);
+				else if (0 == key.compare(g_Keys.modem.rxReaderCore))
+					data[g_Keys.modem.section][g_Keys.modem.rxReaderCore] = getInt(value, "Rx Reader Core", -1, 63, -1);
+				else if (0 == key.compare(g_Keys.modem.rxDemodCore))
+					data[g_Keys.modem.section][g_Keys.modem.rxDemodCore] = getInt(value, "Rx Demodulator Core", -1, 63, -1);
+				else if (0 == key.compare(g_Keys.modem.captureFolder))
+					data[g_Keys.modem.section][g_Keys.modem.captureFolder] = getString(value, g_Keys.modem.captureFolder, rval);
+				else if (0 == key.compare(g_Keys.modem.captureFileSize))
+					data[g_Keys.modem.section][g_Keys.modem.captureFileSize] = getUnsigned(value, "Capture File Size (MB)", 1u, 1024u, 16u);
+				else if (0 == key.compare(g_Keys.modem.captureFiles))
+					data[g_Keys.modem.section][g_Keys.modem.captureFiles] = getUnsigned(value, "Capture Files", 1u, 1000u, 8u);
+				else if (0 == key.compare(g_Keys.modem.txJitterDepth))
+					data[g_Keys.modem.section][g_Keys.modem.txJitterDepth] = getUnsigned(value, "TX Jitter Buffer Depth", 0u, 25u, 2u);
+				else if (0 == key.compare(g_Keys.modem.txJitterMaxDepth))
+					data[g_Keys.modem.section][g_Keys.modem.txJitterMaxDepth] = getUnsigned(value, "TX Jitter Buffer Maximum Depth", 1u, 25u, 10u);
 				else
 					badParam(g_Keys.modem.section, key);
 				break;
@@ -180,6 +194,8 @@ bool CConfigure::ReadData(const std::string &path)
 					data[g_Keys.gateway.section][g_Keys.gateway.allowNotTranscoded] = IS_TRUE(value[0]);
 				else if (0 == key.compare(g_Keys.gateway.audioFolder))
 					data[g_Keys.gateway.section][g_Keys.gateway.audioFolder] = getString(value, g_Keys.gateway.audioFolder, rval);
+				else if (0 == key.compare(g_Keys.gateway.packetPoolSize))
+					data[g_Keys.gateway.section][g_Keys.gateway.packetPoolSize] = getUnsigned(value, "Packet Pool Size", 64u, 8192u, 256u);
 				else
 					badParam(g_Keys.gateway.section, key);
 				break;
@@ -269,6 +285,28 @@ bool CConfigure::ReadData(const std::string &path)
 	isDefined(ErrorLevel::fatal, g_Keys.modem.section, g_Keys.modem.freqCorr, rval);
 	isDefined(ErrorLevel::fatal, g_Keys.modem.section, g_Keys.modem.txPower,  rval);
 	isDefined(ErrorLevel::fatal, g_Keys.modem.section, g_Keys.modem.debug,    rval);
+	if (not data[g_Keys.modem.section].contains(g_Keys.modem.rxReaderCore))
+		data[g_Keys.modem.section][g_Keys.modem.rxReaderCore] = -1;
+	if (not data[g_Keys.modem.section].contains(g_Keys.modem.rxDemodCore))
+		data[g_Keys.modem.section][g_Keys.modem.rxDemodCore] = -1;
+	if (data[g_Keys.modem.section].contains(g_Keys.modem.captureFolder))
+	{
+		const auto path = GetString(g_Keys.modem.section, g_Keys.modem.captureFolder);
+		checkPath(g_Keys.modem.section, g_Keys.modem.captureFolder, path, std::filesystem::file_type::directory);
+	}
+	if (not data[g_Keys.modem.section].contains(g_Keys.modem.captureFileSize))
+		data[g_Keys.modem.section][g_Keys.modem.captureFileSize] = 16u;
+	if (not data[g_Keys.modem.section].contains(g_Keys.modem.captureFiles))
+		data[g_Keys.modem.section][g_Keys.modem.captureFiles] = 8u;
+	if (not data[g_Keys.modem.section].contains(g_Keys.modem.txJitterDepth))
+		data[g_Keys.modem.section][g_Keys.modem.txJitterDepth] = 2u;
+	if (not data[g_Keys.modem.section].contains(g_Keys.modem.txJitterMaxDepth))
+		data[g_Keys.modem.section][g_Keys.modem.txJitterMaxDepth] = 10u;
+	if (GetUnsigned(g_Keys.modem.section, g_Keys.modem.txJitterDepth) > GetUnsigned(g_Keys.modem.section, g_Keys.modem.txJitterMaxDepth))
+	{
+		std::cout << "WARNING: " << g_Keys.modem.txJitterDepth << " is more than " << g_Keys.modem.txJitterMaxDepth << ", it will be reduced" << std::endl;
+		data[g_Keys.modem.section][g_Keys.modem.txJitterDepth] = GetUnsigned(g_Keys.modem.section, g_Keys.modem.txJitterMaxDepth);
+	}
 
 	// Gateway section
 	isDefined(ErrorLevel::fatal, g_Keys.gateway.section, g_Keys.gateway.ipv4, rval);
@@ -303,6 +341,8 @@ bool CConfigure::ReadData(const std::string &path)
 		const auto path = GetString(g_Keys.gateway.section, g_Keys.gateway.audioFolder);
 		checkPath(g_Keys.gateway.section, g_Keys.gateway.audioFolder, path, std::filesystem::file_type::directory);
 	}
+	if (not data[g_Keys.gateway.section].contains(g_Keys.gateway.packetPoolSize))
+		data[g_Keys.gateway.section][g_Keys.gateway.packetPoolSize] = 256u;
 
 	// dashboard section
 	isDefined(ErrorLevel::fatal, g_Keys.dashboard.section, g_Keys.dashboard.lhcount, rval);
@@ -0,0 +1,257 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "EventLoop.h"
+
+// the one event loop, for the UART, the sockets and the gateway's timers
+CEventLoop g_EventLoop;
+
+bool CEventLoop::Start(int core)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (epfd < 0 or stopfd < 0)
+	{
+		Log(EUnit::loop, "Could not make the event loop: %s\n", strerror(errno));
+		return true;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = stopfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev))
+	{
+		Log(EUnit::loop, "Could not add to the event loop: %s\n", strerror(errno));
+		return true;
+	}
+	postfd = NewNotifier([this]() { runPosted(); });
+	if (postfd < 0)
+		return true;
+	wakeups = 0;
+	keep_running = true;
+	loopFuture = std::async(std::launch::async, &CEventLoop::run, this, core);
+	if (not loopFuture.valid())
+	{
+		Log(EUnit::loop, "Could not start the event loop thread\n");
+		keep_running = false;
+		return true;
+	}
+	return false;
+}
+
+void CEventLoop::Stop()
+{
+	{
+		// nothing more can be posted, postfd is closed below, with the other notifiers
+		std::lock_guard<std::mutex> lg(postMtx);
+		postfd = -1;
+		posted.clear();
+	}
+	keep_running = false;
+	if (stopfd >= 0)
+		Notify(stopfd);
+	if (loopFuture.valid())
+	{
+		loopFuture.get();
+		Log(EUnit::loop, "Event loop stopped after %llu wakeups\n", (unsigned long long)wakeups);
+	}
+	{
+		std::lock_guard<std::recursive_mutex> lg(mtx);
+		for (auto &s : sources)
+			if (EEventSource::fd != s.second->type)
+				close(s.first);
+		sources.clear();
+	}
+	if (stopfd >= 0)
+		close(stopfd);
+	if (epfd >= 0)
+		close(epfd);
+	stopfd = epfd = -1;
+}
+
+void CEventLoop::Post(std::function<void()> job)
+{
+	std::lock_guard<std::mutex> lg(postMtx);
+	if (postfd < 0)
+		return;	// the loop isn't running, there's nobody to run it
+	posted.push_back(std::move(job));
+	Notify(postfd);
+}
+
+void CEventLoop::runPosted()
+{
+	std::vector<std::function<void()>> jobs;
+	{
+		std::lock_guard<std::mutex> lg(postMtx);
+		jobs.swap(posted);
+	}
+	for (auto &job : jobs)
+		job();
+}
+
+bool CEventLoop::add(int fd, EEventSource type, uint32_t events, std::function<void(uint32_t)> callback)
+{
+	std::lock_guard<std::recursive_mutex> lg(mtx);
+	sources[fd] = std::make_shared<SSource>(SSource { type, std::move(callback) });
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+	{
+		Log(EUnit::loop, "Could not add fd %d to the event loop: %s\n", fd, strerror(errno));
+		sources.erase(fd);
+		return true;
+	}
+	return false;
+}
+
+bool CEventLoop::Add(int fd, uint32_t events, std::function<void(uint32_t)> callback)
+{
+	return add(fd, EEventSource::fd, events, std::move(callback));
+}
+
+void CEventLoop::Remove(int fd)
+{
+	if (fd < 0)
+		return;
+	std::lock_guard<std::recursive_mutex> lg(mtx);
+	auto it = sources.find(fd);
+	if (sources.end() == it)
+		return;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+	// the loop owns the timers and notifiers
+	if (EEventSource::fd != it->second->type)
+		close(fd);
+	sources.erase(it);
+}
+
+int CEventLoop::NewTimer(std::function<void()> callback)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0)
+	{
+		Log(EUnit::loop, "timerfd_create() error: %s\n", strerror(errno));
+		return -1;
+	}
+	if (add(fd, EEventSource::timer, EPOLLIN, [cb = std::move(callback)](uint32_t) { cb(); }))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void CEventLoop::SetTimer(int timer, unsigned ms, unsigned period_ms)
+{
+	if (timer < 0)
+		return;
+	struct itimerspec its;
+	its.it_value.tv_sec = ms / 1000u;
+	its.it_value.tv_nsec = (ms % 1000u) * 1000000l;
+	its.it_interval.tv_sec = period_ms / 1000u;
+	its.it_interval.tv_nsec = (period_ms % 1000u) * 1000000l;
+	if (timerfd_settime(timer, 0, &its, nullptr))
+		Log(EUnit::loop, "timerfd_settime() error: %s\n", strerror(errno));
+}
+
+int CEventLoop::NewNotifier(std::function<void()> callback)
+{
+	int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0)
+	{
+		Log(EUnit::loop, "eventfd() error: %s\n", strerror(errno));
+		return -1;
+	}
+	if (add(fd, EEventSource::notifier, EPOLLIN, [cb = std::move(callback)](uint32_t) { cb(); }))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void CEventLoop::Notify(int notifier)
+{
+	if (notifier < 0)
+		return;
+	const uint64_t one = 1;
+	// if the counter is somehow full, the loop is going to wake up anyway
+	if (sizeof(one) != write(notifier, &one, sizeof(one)) and EAGAIN != errno)
+		Log(EUnit::loop, "eventfd write() error: %s\n", strerror(errno));
+}
+
+void CEventLoop::run(int core)
+{
+	if (core >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(core, &cpus);
+		auto rv = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (rv)
+			Log(EUnit::loop, "Could not pin the event loop thread to core %d: %s\n", core, strerror(rv));
+		else
+			Log(EUnit::loop, "Event loop thread is pinned to core %d\n", core);
+	}
+
+	struct epoll_event events[16];
+	while (keep_running)
+	{
+		const int n = epoll_wait(epfd, events, 16, -1);
+		if (n < 0)
+		{
+			if (EINTR == errno)
+				continue;
+			Log(EUnit::loop, "epoll_wait() error: %s\n", strerror(errno));
+			keep_running = false;
+			raise(SIGINT);
+			return;
+		}
+		wakeups++;
+		for (int i=0; i<n and keep_running; i++)
+		{
+			const int fd = events[i].data.fd;
+			if (stopfd == fd)
+				continue;
+			std::lock_guard<std::recursive_mutex> lg(mtx);
+			auto it = sources.find(fd);
+			if (sources.end() == it)
+				continue;	// it was removed by an earlier callback
+			// keep it, even if its callback removes it
+			auto source = it->second;
+			if (EEventSource::fd != source->type)
+			{
+				// clear the timer's expirations, or the notifier's count
+				uint64_t count;
+				if (sizeof(count) != read(fd, &count, sizeof(count)))
+					continue;
+			}
+			source->callback(events[i].events);
+		}
+	}
+}
@@ -0,0 +1,86 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <map>
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include "Base.h"
+
+enum class EEventSource { fd, timer, notifier };
+
+// An epoll event loop, run on its own thread. It waits on file descriptors, on timers (a timerfd)
+// and on notifiers (an eventfd another thread can poke), and calls back when one is ready.
+// Nothing wakes it up unless there's something to do, it has no timeout of its own.
+// Every callback runs on the loop's thread, one at a time, so they mustn't block for long.
+class CEventLoop : public CBase
+{
+public:
+	~CEventLoop() { Stop(); }
+	// returns true on error, core >= 0 pins the loop's thread to that core
+	bool Start(int core = -1);
+	void Stop();
+
+	// watch fd for events (EPOLLIN...), returns true on error
+	bool Add(int fd, uint32_t events, std::function<void(uint32_t)> callback);
+	// stop watching fd, or delete a timer or notifier. Once this returns its callback isn't running
+	// and won't be called again, unless Remove() was called from the callback itself.
+	void Remove(int fd);
+
+	// a new timer, disarmed, returns -1 on error
+	int NewTimer(std::function<void()> callback);
+	// fire after ms, then every period_ms if it's not zero, ms == 0 disarms it
+	void SetTimer(int timer, unsigned ms, unsigned period_ms = 0);
+
+	// a new notifier, returns -1 on error
+	int NewNotifier(std::function<void()> callback);
+	// from any thread, call the notifier's callback soon, several Notify() might be only one callback
+	void Notify(int notifier);
+
+	// from any thread, run job on the loop's thread soon, the jobs run in the order they were posted
+	void Post(std::function<void()> job);
+
+private:
+	using SSource = struct source_tag
+	{
+		EEventSource type;
+		std::function<void(uint32_t)> callback;
+	};
+
+	void run(int core);
+	bool add(int fd, EEventSource type, uint32_t events, std::function<void(uint32_t)> callback);
+
+	void runPosted();
+
+	int epfd = -1, stopfd = -1, postfd = -1;
+	std::atomic<bool> keep_running { false };
+	std::future<void> loopFuture;
+	// held while a callback runs, so Remove() from another thread can wait for it
+	std::recursive_mutex mtx;
+	std::map<int, std::shared_ptr<SSource>> sources;
+	std::mutex postMtx;
+	std::vector<std::function<void()>> posted;
+	uint64_t wakeups = 0;
+};
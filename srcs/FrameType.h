@@ -26,6 +26,9 @@ enum class EEncryptType { none, scram8, scram16, scram24, aes128, aes192, aes256
 enum class EMetaDatType { none, gnss, ecd, text, aes };
 enum class EVersionType { legacy, v3 };
 
+// the Codec2 3200 quiet frame, 20 ms, there are two in each 3200 stream frame
+inline constexpr uint8_t c2_quiet[8] { 0x01u, 0x00u, 0x09u, 0x43u, 0x9Cu, 0xE4u, 0x21u, 0x08u };
+
 class CFrameType
 {
 public:
@@ -20,10 +20,8 @@
 #include <sstream>
 #include <fstream>
 #include <string>
-#include <thread>
 #include <chrono>
-
-#include <poll.h>
+#include <memory>
 
 #include "SafePacketQueue.h"
 #include "SteadyTimer.h"
@@ -51,72 +49,107 @@ static const std::string fnames[40]{
 	"five", "six", "seven", "eight", "nine", "dash", "slash", "dot"
 };
 
-void CGateway::wait4end(std::unique_ptr<CPacket> &p)
+// The rest of the stream that carried an RF command comes to rfCommandPacket(), and when
+// it ends, or times out in housekeeping(), then is called.
+void CGateway::wait4end(std::unique_ptr<CPacket> &p, std::function<void()> then)
 {
 	// check the starting packet first
 	if (p->IsLastPacket())
+	{
+		then();
 		return;
+	}
 
 	// we're only going to reset the packet timer if subsequent incoming packets have this SID
-	auto streamid = p->GetStreamId();
+	rfCmd.type = ERfCmd::wait4end;
+	rfCmd.sid = p->GetStreamId();
+	rfCmd.then = std::move(then);
+	rfCmd.timer.start();
+}
 
-	CSteadyTimer ptime; // the timeout timer
-	while (keep_running)
+void CGateway::rfCommandPacket(std::unique_ptr<CPacket> &p)
+{
+	if (ERfCmd::wait4end == rfCmd.type)
 	{
-		auto p = Modem2Gate.PopWaitFor(40);
-		if (p)
+		p->Initialize(EPacketType::stream);
+		if (p->GetStreamId() == rfCmd.sid and p->IsLastPacket())
 		{
-			p->Initialize(EPacketType::stream);
-			if (p->GetStreamId() == streamid)
-			{
-				if (p->IsLastPacket())
-					break;
-			}
-			ptime.start();
+			endRfCommand();
+			return;
 		}
-		if (ptime.time() > 0.5)
-			break; // a timeout!
+		rfCmd.timer.start();
+	}
+	else if (ERfCmd::record == rfCmd.type)
+	{
+		if (EPacketType::stream != p->GetType() or rfCmd.sid != p->GetStreamId())
+			return;
+		rfCmd.timer.start();
+		if (++rfCmd.fn < 3000) // only collect up to 2 minutes
+		{
+			playbackQueue.emplace(p->GetPayload());
+		}
+		if (p->IsLastPacket())
+			endRfCommand();
 	}
-	return;
+}
+
+// the stream is over, or it timed out
+void CGateway::endRfCommand()
+{
+	auto then = std::move(rfCmd.then);
+	rfCmd.then = nullptr;
+	if (ERfCmd::record == rfCmd.type)
+	{
+		rfCmd.type = ERfCmd::none;
+		saveRecording();
+	}
+	rfCmd.type = ERfCmd::none;
+	if (then)
+		then();
 }
 
 void CGateway::doStatus(std::unique_ptr<CPacket> &p)
 {
-	wait4end(p);
-	if (ELinkState::linked == mlink.state)
-		addMessage("repeater is_linked_to destination");
-	else if (ELinkState::linking == mlink.state)
-		addMessage("repeater is_linking");
-	else
-		addMessage("repeater is_unlinked");
-	g_GateState.HandleRfCommand(EGateState::idle);
+	wait4end(p, [this]() {
+		if (ELinkState::linked == mlink.state)
+			addMessage("repeater is_linked_to destination");
+		else if (ELinkState::linking == mlink.state)
+			addMessage("repeater is_linking");
+		else
+			addMessage("repeater is_unlinked");
+		g_GateState.HandleRfCommand(EGateState::idle);
+		g_GateState.Idle();
+	});
 }
 
 void CGateway::doUnlink(std::unique_ptr<CPacket> &p)
 {
-	wait4end(p);
-	if (ELinkState::unlinked == mlink.state)
-	{
-		addMessage("repeater is_already_unlinked");
-		Log(EUnit::gate, "%s is already unlinked\n", thisCS.c_str());
-	}
-	else
-	{
-		// make and send the DISConnect packet
-		SM17RefPacket disc;
-		memcpy(disc.magic, "DISC", 4);
-		thisCS.CodeOut(disc.cscode);
-		sendPacket(disc.magic, 10, mlink.addr);
-		Log(EUnit::gate, "DISConnect packet sent to %s\n", mlink.cs.c_str());
-		// the gateway proccess loop will disconnect when is receives the confirming DISC packet.
-	}
-	g_GateState.HandleRfCommand(EGateState::idle);
+	wait4end(p, [this]() {
+		if (ELinkState::unlinked == mlink.state)
+		{
+			addMessage("repeater is_already_unlinked");
+			Log(EUnit::gate, "%s is already unlinked\n", thisCS.c_str());
+		}
+		else
+		{
+			// make and send the DISConnect packet
+			SM17RefPacket disc;
+			memcpy(disc.magic, "DISC", 4);
+			thisCS.CodeOut(disc.cscode);
+			sendPacket(disc.magic, 10, mlink.addr);
+			Log(EUnit::gate, "DISConnect packet sent to %s\n", mlink.cs.c_str());
+			// the gateway will disconnect when is receives the confirming DISC packet.
+		}
+		g_GateState.HandleRfCommand(EGateState::idle);
+		g_GateState.Idle();
+	});
 }
 
 void CGateway::doEcho(std::unique_ptr<CPacket> &p)
 {
 	if (p->IsLastPacket())
 	{
+		g_GateState.Idle();
 		return;
 	}
 	auto streamID = p->GetStreamId();
@@ -128,6 +161,7 @@ void CGateway::doRecord(std::unique_ptr<CPacket> &p)
 {
 	if (p->IsLastPacket())
 	{
+		g_GateState.Idle();
 		return;
 	}
 	const CCallsign dst(p->GetCDstAddress());
@@ -135,35 +169,23 @@ void CGateway::doRecord(std::unique_ptr<CPacket> &p)
 	doRecord(dst.GetModule(), streamID);
 }
 
+// the payloads are collected in playbackQueue by rfCommandPacket(), then saveRecording() writes them
 void CGateway::doRecord(char c, uint16_t streamID)
 {
-	// record payload in queue
 	while (playbackQueue.size())
 		playbackQueue.pop();
-	uint16_t fn = 0;
-	CSteadyTimer timer;
-	while (true) // record the payloads in playbackQueue
-	{
-		auto p = Modem2Gate.PopWaitFor(40);
-		if (nullptr == p)
-			continue;
-		if (timer.time() > 0.12)	// 3 frames 
-		{
-			Log(EUnit::gate, "Voice Recorder timeout!\n");
-			break;
-		}
-		if (EPacketType::stream != p->GetType())
-			continue;
-		if (streamID != p->GetStreamId())
-			continue;
-		timer.start();
-		if (++fn < 3000) // only collect up to 2 minutes
-		{
-			playbackQueue.emplace(p->GetPayload());
-		}
-		if (p->IsLastPacket())
-			break;
-	}
+	rfCmd.type = ERfCmd::record;
+	rfCmd.sid = streamID;
+	rfCmd.module = c;
+	rfCmd.fn = 0;
+	rfCmd.then = nullptr;
+	rfCmd.timer.start();
+}
+
+void CGateway::saveRecording()
+{
+	const auto c = rfCmd.module;
+	const auto fn = rfCmd.fn;
 	if (fn > 3000)
 	{
 		Log(EUnit::gate, "Too long, did not save the last %.2f seconds of the transmission\n", 0.04f * (fn - 3000));
@@ -173,6 +195,7 @@ void CGateway::doRecord(char c, uint16_t streamID)
 		while (not playbackQueue.empty())
 			playbackQueue.pop();
 		Log(EUnit::gate, "Only recorded %d milliseconds, not saved\n", 40 * fn);
+		g_GateState.Idle();
 		return;
 	}
 
@@ -192,42 +215,53 @@ void CGateway::doRecord(char c, uint16_t streamID)
 	std::filesystem::path pathname(audioPath);
 	pathname /= fnames[pos];
 
-	// open the file and write the data
-	std::ofstream ofs(pathname, std::ios::binary | std::ios::trunc);
-	if (ofs.is_open())
-	{
-		while (not playbackQueue.empty())
+	// open the file and write the data, on the worker, it's done before doPlay() reads it back
+	auto payloads = std::make_shared<std::queue<CPayload>>(std::move(playbackQueue));
+	playbackQueue = std::queue<CPayload>();
+	worker.Post([this, pathname, payloads]() {
+		std::ofstream ofs(pathname, std::ios::binary | std::ios::trunc);
+		if (ofs.is_open())
 		{
-			ofs.write((char *)playbackQueue.front().Data(), 16);
-			playbackQueue.pop();
+			while (not payloads->empty())
+			{
+				ofs.write((char *)payloads->front().Data(), 16);
+				payloads->pop();
+			}
+			ofs.close();
 		}
-		ofs.close();
-	}
-	else
-	{
-		Log(EUnit::gate, "Could not open %s for writing\n", pathname.c_str());
-	}
+		else
+		{
+			Log(EUnit::gate, "Could not open %s for writing\n", pathname.c_str());
+		}
+	});
 
 	// after a short wait
-	std::this_thread::sleep_for(std::chrono::milliseconds(500));
-	if (g_GateState.HandleRfCommand(EGateState::gatestreamin))
-		doPlay(c);
-	else
-		Log(EUnit::gate, "doRecord() could not set state for playback. Current state is %s\n", g_GateState.GetStateName());
+	later(500, [this, c]() {
+		if (g_GateState.HandleRfCommand(EGateState::gatestreamin))
+			doPlay(c);
+		else
+		{
+			Log(EUnit::gate, "saveRecording() could not set state for playback. Current state is %s\n", g_GateState.GetStateName());
+			g_GateState.Idle();
+		}
+	});
 }
 
 void CGateway::doPlay(std::unique_ptr<CPacket> &p)
 {
-	wait4end(p);
-	if (g_GateState.HandleRfCommand(EGateState::gatestreamin)) {
-		std::this_thread::sleep_for(std::chrono::milliseconds(300));
-		CCallsign dst(p->GetCDstAddress());
-		doPlay(dst.GetModule());
-	} else {
-		Log(EUnit::gate, "doPlay() could not set state for playback. Current state is %s\n", g_GateState.GetStateName());
-	}
+	const CCallsign dst(p->GetCDstAddress());
+	const char c = dst.GetModule();
+	wait4end(p, [this, c]() {
+		if (g_GateState.HandleRfCommand(EGateState::gatestreamin)) {
+			later(300, [this, c]() { doPlay(c); });
+		} else {
+			Log(EUnit::gate, "doPlay() could not set state for playback. Current state is %s\n", g_GateState.GetStateName());
+			g_GateState.Idle();
+		}
+	});
 }
 
+// the recording goes out on the voice timer, then the state goes back to idle
 void CGateway::doPlay(char c)
 {
 	// make the file pathname
@@ -239,10 +273,16 @@ void CGateway::doPlay(char c)
 			Log(EUnit::gate, "'%c' is not a valid M17 character\n", c);
 		else
 			Log(EUnit::gate, "0x%02x is not a valid M17 character\n", unsigned(c));
+		g_GateState.Idle();
 		return;
 	}
 	pathname /= fnames[pos];
 
+	worker.Post([this, pathname, sid = g_RNG.Get()]() { readRecording(pathname, sid); });
+}
+
+void CGateway::readRecording(const std::filesystem::path &pathname, uint16_t sid)
+{
 	uint16_t fc = 0;
 
 	// make sure the file exists and its size looks okay
@@ -253,6 +293,7 @@ void CGateway::doPlay(char c)
 		if ((size % 16) or (size / 16 < 25) or (size / 16 > 3000))
 		{
 			Log(EUnit::gate, "'%s' has an unexpected file size of %u\n", pathname.c_str(), size);
+			g_GateState.Idle();
 			return;
 		}
 		fc = uint16_t(size / 16) - 1u; // this is the last frame number
@@ -269,28 +310,27 @@ void CGateway::doPlay(char c)
 	// now build a master
 	CPacket master;
 	master.Initialize(EPacketType::stream);
-	master.SetStreamId(g_RNG.Get());
+	master.SetStreamId(sid);
 	memset(master.GetDstAddress(), 0xffu, 6); // set destination to Broadcast
 	thisCS.CodeOut(master.GetSrcAddress());
 	master.SetFrameType(ft.GetFrameType(radioTypeIsV3 ? EVersionType::v3 : EVersionType::legacy));
 
 	std::ifstream ifs(pathname, std::ios::binary);
-	auto clock = std::chrono::steady_clock::now(); // start the packet clock
+	std::queue<SStreamFrame> frames;
 	if (ifs.is_open())
 	{
 		for (uint16_t fn=0; fn<=fc; fn++)
 		{
-			auto p = std::make_unique<CPacket>();
-			p->Initialize(EPacketType::stream, master.GetCData());
-			ifs.read((char *)(p->GetPayload()), 16);
-			p->SetFrameNumber((fn==fc) ? (fn | 0x8000u) : fn);
-			p->CalcCRC();
-			clock = clock + std::chrono::milliseconds(40);
-			std::this_thread::sleep_until(clock);
-			Gate2Modem.Push(p);
+			ifs.read((char *)(master.GetPayload()), 16);
+			master.SetFrameNumber((fn==fc) ? (fn | 0x8000u) : fn);
+			master.CalcCRC();
+			frames.emplace();
+			memcpy(frames.back().data(), master.GetCData(), 54);
 		}
 		ifs.close();
 	}
 	else
 		Log(EUnit::gate, "Could not open file '%s'\n", pathname.c_str());
+	auto f = std::make_shared<std::queue<SStreamFrame>>(std::move(frames));
+	toLoop([this, f]() { play(std::move(*f), 0u, []() { g_GateState.Idle(); }); });
 }
@@ -16,8 +16,11 @@
 	along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "EventLoop.h"
 #include "GateState.h"
 
+extern CEventLoop g_EventLoop;
+
 // the one and only Tx/Rx state
 CGateState g_GateState;
 
@@ -51,13 +54,13 @@ void CGateState::Set2IdleIfGateIn(void)
 {
 	std::lock_guard<std::mutex> lg(mtx);
 	if (EGateState::messagein==currentState or EGateState::gatestreamin==currentState or EGateState::gatepacketin==currentState)
-		currentState = EGateState::idle;
+		set(EGateState::idle);
 }
 
 void CGateState::Idle()
 {
 	std::lock_guard<std::mutex> lg(mtx);
-	currentState = EGateState::idle;
+	set(EGateState::idle);
 }
 
 bool CGateState::HandleRfCommand(EGateState toState)
@@ -65,7 +68,7 @@ bool CGateState::HandleRfCommand(EGateState toState)
 	std::lock_guard<std::mutex> lg(mtx);
 	if (EGateState::modemin==currentState or EGateState::rftimeout==currentState)
 	{
-		currentState = toState;
+		set(toState);
 		return true;
 	}
 	return false;
@@ -77,7 +80,7 @@ bool CGateState::SetStateToOnlyIfFrom(EGateState tostate, EGateState fromstate)
 	std::lock_guard<std::mutex> lg(mtx);
 	if (fromstate == currentState)
 	{
-		currentState = tostate;
+		set(tostate);
 		return true;
 	}
 	return false;
@@ -116,8 +119,23 @@ bool CGateState::TryState(EGateState newstate)
 		return true;
 	if (EGateState::idle == currentState)
 	{
-		currentState = newstate;
+		set(newstate);
 		return true;
 	}
 	return false;
 }
+
+void CGateState::SetNotifier(int n)
+{
+	std::lock_guard<std::mutex> lg(mtx);
+	notifier = n;
+}
+
+// mtx has to be held
+void CGateState::set(EGateState newstate)
+{
+	if (newstate == currentState)
+		return;
+	currentState = newstate;
+	g_EventLoop.Notify(notifier);
+}
@@ -39,8 +39,13 @@ public:
 	// returns true if successful
 	bool TryState(EGateState newstate);
 	bool HandleRfCommand(EGateState toState);
+	// the event loop notifier that's poked every time the state changes, -1 for none
+	void SetNotifier(int n);
 
 private:
+	void set(EGateState newstate);
+
 	std::mutex mtx;
 	EGateState currentState;
+	int notifier = -1;
 };
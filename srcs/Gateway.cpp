@@ -16,18 +16,21 @@
 	along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include <poll.h>
+#include <sys/epoll.h>
 #include <string>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <cstring>
-#include <thread>
+#include <memory>
 #include <chrono>
+#include <cmath>
+#include <array>
 #include <map>
 
 #include "SafePacketQueue.h"
+#include "EventLoop.h"
 #include "FrameType.h"
 #include "Configure.h"
 #include "GateState.h"
@@ -42,9 +45,7 @@ extern CConfigure  g_Cfg;
 extern CGateState  g_GateState;
 extern IPFrameFIFO Modem2Gate;
 extern IPFrameFIFO Gate2Modem;
-
-
-static const uint8_t quiet[] { 0x01u, 0x00u, 0x09u, 0x43u, 0x9Cu, 0xE4u, 0x21u, 0x08u };
+extern CEventLoop  g_EventLoop;
 
 // for calculating switch case values for host command processor
 constexpr uint64_t CalcCSCode(const char *cs)
@@ -93,19 +94,25 @@ constexpr uint64_t CalcCSCode(const char *cs)
 void CGateway::Stop()
 {
 	Log(EUnit::gate, "stopping the Gateway...\n");
-	keep_running = false;
-	if (gateFuture.valid())
-		gateFuture.get();
-	if (modemFuture.valid())
-		modemFuture.get();
-	Log(EUnit::gate, "Gateway and Modem processing threads closed...\n");
+	running = false;
+	Modem2Gate.SetNotifier(-1);
+	g_GateState.SetNotifier(-1);
+	for (int fd : { ipv4.GetSocket(), ipv6.GetSocket(), houseTimer, voiceTimer, laterTimer, notifier })
+		g_EventLoop.Remove(fd);
+	houseTimer = voiceTimer = laterTimer = notifier = -1;
+	voice.active = false;
+	rfCmd.type = ERfCmd::none;
+	Log(EUnit::gate, "Gateway and Modem processing removed from the event loop...\n");
+	// finish the database writes that are still waiting
+	worker.Stop();
 	ipv4.Close();
 	ipv6.Close();
 	Log(EUnit::gate, "All Gateway resourced released\n");
 }
 
-bool CGateway::Start()
+bool CGateway::Prepare()
 {
+	const auto start = std::chrono::steady_clock::now();
 	if (dataBase.Open(g_Cfg.GetString(g_Keys.gateway.section, g_Keys.gateway.dbPath).c_str()))
 		return true;
 	auto hosts = g_Cfg.GetString(g_Keys.gateway.section, g_Keys.gateway.hostPath);
@@ -171,7 +178,6 @@ bool CGateway::Start()
 	Log(EUnit::gate, "Radio is using %s TYPE values\n", radioTypeIsV3 ? "V#3" : "Legacy");
 
 	mlink.state = ELinkState::unlinked;
-	keep_running = true;
 	gateStream.Initialize(EStreamType::gate);
 	modemStream.Initialize(EStreamType::modem);
 	mlink.maintainLink = g_Cfg.GetBoolean(g_Keys.gateway.section, g_Keys.gateway.maintainLink);
@@ -186,394 +192,424 @@ bool CGateway::Start()
 
 	makeCSData(thisCS, "repeater.dat");
 
-	addMessage("welcome repeater");
-	gateFuture = std::async(std::launch::async, &CGateway::processGateway, this);
-	if (not gateFuture.valid())
+	Log(EUnit::gate, "Gateway preparation took %u ms\n", unsigned(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
+	return false;
+}
+
+bool CGateway::Start()
+{
+	if (worker.Start("gateway worker"))
+		return true;
+	running = true;
+	houseTimer = g_EventLoop.NewTimer([this]() { housekeeping(); });
+	voiceTimer = g_EventLoop.NewTimer([this]() { onVoiceTick(); housekeeping(); });
+	laterTimer = g_EventLoop.NewTimer([this]() { auto fn = std::move(laterFn); laterFn = nullptr; if (fn) fn(); housekeeping(); });
+	notifier = g_EventLoop.NewNotifier([this]() { onModem(); housekeeping(); });
+	if (houseTimer < 0 or voiceTimer < 0 or laterTimer < 0 or notifier < 0)
 	{
-		Log(EUnit::gate, "Could not start the processGateway() thread\n");
-		keep_running = false;
+		Log(EUnit::gate, "Could not add the Gateway timers to the event loop\n");
 		return true;
 	}
-
-	modemFuture = std::async(std::launch::async, &CGateway::processModem, this);
-	if (not modemFuture.valid())
+	for (auto sock : { &ipv4, &ipv6 })
 	{
-		Log(EUnit::gate, "Could not start the processModem() thread\n");
-		keep_running = false;
-		return true;
+		if (sock->GetSocket() < 0)
+			continue;
+		if (g_EventLoop.Add(sock->GetSocket(), EPOLLIN, [this, sock](uint32_t events) { onSocket(*sock, events); housekeeping(); }))
+			return true;
 	}
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+	addMessage("welcome repeater");
+	// whatever the modem and the state machine do now wakes the gateway
+	Modem2Gate.SetNotifier(notifier);
+	g_GateState.SetNotifier(notifier);
+	g_EventLoop.Notify(notifier);
 	return false;
 }
 
-void CGateway::processGateway()
+void CGateway::housekeeping()
 {
-	struct pollfd pfds[2];
-	for (unsigned i=0; i<2; i++)
+	// the soonest something has to be looked at again, in seconds
+	double next = -1.0;
+	const auto soonest = [&next](double t) { if (next < 0.0 or t < next) next = t; };
+
+	// do link maintenance
+	if (ELinkState::linked == mlink.state)
 	{
-		pfds[i].fd = i ? ipv6.GetSocket() : ipv4.GetSocket();
-		pfds[i].events = POLLIN;
-		pfds[i].revents = 0;
+		if (mlink.receivePingTimer.time() > 30.0) // is the reflector okay?
+		{
+			// looks like we lost contact
+			addMessage("repeater was_disconnected_from destination");
+			Log(EUnit::gate, "Disconnected from %s, TIMEOUT...\n", mlink.cs.c_str());
+			mlink.state = ELinkState::unlinked;
+			worker.Post([this]() { dataBase.ClearTable("linkstatus"); });
+			if (not mlink.maintainLink)
+				mlink.addr.Clear();
+		}
+		else
+			soonest(30.0 - mlink.receivePingTimer.time());
+	}
+	if (ELinkState::linking == mlink.state)
+	{
+		if (linkingTime.time() >= 30.0)
+		{
+			Log(EUnit::gate, "Link request to %s timeout.\n", mlink.cs.c_str());
+			mlink.state = ELinkState::unlinked;
+		}
+		else
+		{
+			if (lastLinkSent.time() > 5.0)
+				sendLinkRequest();
+			soonest(30.0 - linkingTime.time());
+			soonest(5.0 - lastLinkSent.time());
+		}
+	}
+	else if (ELinkState::unlinked == mlink.state)
+	{
+		if (not mlink.addr.AddressIsZero())
+		{
+			if (mlink.isReflector)
+			{
+				linkingTime.start();
+				sendLinkRequest();
+				soonest(5.0);
+			}
+		}
 	}
 
-	while (keep_running)
+	// check for stream timeouts
+	if (gateStream.IsOpen())
 	{
-		// do link maintenance
-		switch (mlink.state)
+		if (gateStream.GetLastTime() >= 1.6)
 		{
-		case ELinkState::linked:
-			if (mlink.receivePingTimer.time() > 30.0) // is the reflector okay?
+			closeStream(gateStream, true);
+			g_GateState.Idle();
+		}
+		else
+			soonest(1.6 - gateStream.GetLastTime());
+	}
+	if (modemStream.IsOpen())
+	{
+		if (modemStream.GetLastTime() >= 1.0)
+		{
+			closeStream(modemStream, true); // close the modemStream
+			g_GateState.Idle();
+		}
+		else
+			soonest(1.0 - modemStream.GetLastTime());
+	}
+
+	// an RF command that's waiting for the rest of its stream
+	if (ERfCmd::none != rfCmd.type)
+	{
+		const double limit = (ERfCmd::record == rfCmd.type) ? 0.12 : 0.5; // 3 frames when recording
+		if (rfCmd.timer.time() > limit)
+		{
+			if (ERfCmd::record == rfCmd.type)
+				Log(EUnit::gate, "Voice Recorder timeout!\n");
+			endRfCommand();
+		}
+		else
+			soonest(limit - rfCmd.timer.time());
+	}
+
+	// nothing is left of an RF command, so the modem can have the channel back
+	if (ERfCmd::none == rfCmd.type and not laterFn and g_GateState.SetStateToOnlyIfFrom(EGateState::idle, EGateState::rftimeout))
+		Log(EUnit::gate, "Reset state to idle from RF timeout\n");
+
+	// can we play an audio message?
+	if (not voiceQueue.Empty() and not voice.active)
+	{
+		if ((EGateState::bootup == g_GateState.GetState()) or g_GateState.TryState(EGateState::messagein))
+		{
+			auto message = voiceQueue.Pop();
+			Log(EUnit::gate, "Playing message '%s'\n", message.c_str());
+			voice.active = true; // until its frames come back from the worker
+			worker.Post([this, message, sid = g_RNG.Get()]() { PlayVoiceFiles(message, sid); });
+		}
+	}
+
+	// finally, if we can, send a saved PM data. It should already be in the lastheard.
+	if (not pmQueue.IsEmpty() and g_GateState.SetStateToOnlyIfFrom(EGateState::gatepacketin, EGateState::idle))
+	{
+		auto p = pmQueue.PopWait();
+		Gate2Modem.Push(p);
+	}
+
+	// nothing is due, only a packet or a state change will wake us
+	if (next < 0.0)
+		g_EventLoop.SetTimer(houseTimer, 0);
+	else
+		g_EventLoop.SetTimer(houseTimer, std::max(1u, unsigned(std::ceil(next * 1000.0))));
+
+	// everything this pass through the loop had to send goes out together
+	ipv4.Flush();
+	ipv6.Flush();
+}
+
+void CGateway::onSocket(CUDPSocket &sock, uint32_t events)
+{
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		Log(EUnit::gate, "The IPv%c socket returned error events 0x%x, it's closed\n", (&sock == &ipv6) ? '6' : '4', events);
+		g_EventLoop.Remove(sock.GetSocket());
+		return;
+	}
+
+	// drain the socket, a batch at a time, straight into packets from the pool
+	SDatagram dgrams[UDP_BATCH_MAX];
+	unsigned n;
+	do
+	{
+		for (unsigned i=0; i<UDP_BATCH_MAX; i++)
+		{
+			// the ones handed on to the modem are replaced
+			if (not rxPkts[i])
+				rxPkts[i] = std::make_unique<CPacket>();
+			dgrams[i].buf = rxPkts[i]->GetData();
+		}
+		n = sock.ReadMany(dgrams, UDP_BATCH_MAX, MAX_PACKET_SIZE);
+		for (unsigned i=0; i<n; i++)
+		{
+			if (0 == dgrams[i].size)
+				continue;
+			from17k = dgrams[i].addr;
+			processDatagram(rxPkts[i], int(dgrams[i].size));
+		}
+	} while (UDP_BATCH_MAX == n);
+}
+
+// p was received in place, if it's an M17 frame, it goes on to the modem as it is
+void CGateway::processDatagram(std::unique_ptr<CPacket> &p, int length)
+{
+	const uint8_t *buf = p->GetCData();
+	switch (length)	// process known packets
+	{
+	case 4:  				// DISC, ACKN or NACK
+		if ((ELinkState::unlinked != mlink.state) and (from17k == mlink.addr))
+		{
+			if (0 == memcmp(buf, "ACKN", 4))
 			{
-				// looks like we lost contact
-				addMessage("repeater was_disconnected_from destination");
-				Log(EUnit::gate, "Disconnected from %s, TIMEOUT...\n", mlink.cs.c_str());
-				mlink.state = ELinkState::unlinked;
-				dataBase.ClearTable("linkstatus");
-				if (not mlink.maintainLink)
-					mlink.addr.Clear();
+				mlink.state = ELinkState::linked;
+				// the worker makes the file before it builds the message that says it
+				worker.Post([this, cs = std::string(mlink.cs.c_str())]() { makeCSData(CCallsign(cs), "destination.dat"); });
+				addMessage("repeater is_linked_to destination");
+				Log(EUnit::gate, "Connected to %s at %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
+				mlink.receivePingTimer.start();
+				worker.Post([this, addr = std::string(mlink.addr.GetAddress()), port = mlink.addr.GetPort(), cs = std::string(mlink.cs.c_str())]() { dataBase.UpdateLS(addr.c_str(), port, cs.c_str()); });
 			}
-			break;
-		case ELinkState::linking:
-			if (linkingTime.time() >= 30.0)
+			else if (0 == memcmp(buf, "NACK", 4))
 			{
-				Log(EUnit::gate, "Link request to %s timeout.\n", mlink.cs.c_str());
+				addMessage("link_refused");
+				Log(EUnit::gate, "Connection request refused from %s\n", mlink.cs.c_str());
+				mlink.cs.Clear();
+				mlink.addr.Clear();
 				mlink.state = ELinkState::unlinked;
 			}
-			else
+			else if (0 == memcmp(buf, "DISC", 4))
 			{
-				if (lastLinkSent.time() > 5.0)
-					sendLinkRequest();
+				addMessage("repeater is_unlinked");
+				Log(EUnit::gate, "Disconnected from %s at %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
+				mlink.addr.Clear(); // initiated with UNLINK, so don't try to reconnect
+				mlink.cs.Clear();   // ^^^^^^^^^ ^^^^ ^^^^^^
+				worker.Post([this]() { dataBase.ClearTable("linkstatus"); });
+				mlink.state = ELinkState::unlinked;
 			}
-			break;
-		case ELinkState::unlinked:
-			if (not mlink.addr.AddressIsZero())
+			else
 			{
-				if (mlink.isReflector)
-				{
-					linkingTime.start();
-					sendLinkRequest();
-				}
+				Log(EUnit::gate, "Unknown Packet:\n");
+				Dump(nullptr, buf, length);
 			}
-			break;
 		}
-
-		// close the current audio message task
-		if (msgTask and msgTask->isDone)
+		else
+		{
+			Log(EUnit::gate, "Unknown Packet:\n");
+			Dump(nullptr, buf, length);
+		}
+		break;
+	case 10: 				// PING or DISC
+		if ((ELinkState::linked == mlink.state) and (from17k == mlink.addr))
 		{
-			if (msgTask->futTask.valid())
+			if (0 == memcmp(buf, "PING", 4))
 			{
-				auto count = msgTask->futTask.get();
-				Log(EUnit::gate, "Played %.2f sec message\n", count*0.04f);
+				sendPacket(mlink.pongPacket.magic, 10, mlink.addr);
+				mlink.receivePingTimer.start();
+			}
+			else if (0 == memcmp(buf, "DISC", 4))
+			{
+				const CCallsign from(buf+4);
+				if (from == mlink.cs)
+				{
+					addMessage("repeater was_disconnected_from destination");
+					mlink.state = ELinkState::unlinked;
+					if (not mlink.maintainLink)
+						mlink.addr.Clear();
+					worker.Post([this]() { dataBase.ClearTable("linkstatus"); });
+					Log(EUnit::gate, "%s initiated a disconnect\n", from.GetCS().c_str());
+				}
+				else
+					Log(EUnit::gate, "Got a bogus disconnect from '%s' @ %s\n", from.GetCS().c_str(), from17k.GetAddress());
 			}
 			else
 			{
-				Log(EUnit::gate, "Message task is done, but future task is invalid");
+				Log(EUnit::gate, "Unknown Packet:\n");
+				Dump(nullptr, buf, length);
 			}
-			msgTask.reset();
-			if ((EGateState::bootup != g_GateState.GetState()) or voiceQueue.Empty())
-				g_GateState.Idle();
 		}
-
-		// can we play an audio message?
-		if (not voiceQueue.Empty()) {
-			if ((EGateState::bootup == g_GateState.GetState()) or g_GateState.TryState(EGateState::messagein))
+		break;
+	default:
+		auto t = validate(buf, length);
+		if (EPacketType::none == t)
+		{
+			Log(EUnit::gate, "Unknown Packet:\n");
+			Dump(nullptr, buf, length);
+		} else {
+			p->Received(t, length);
+			if (p->CheckCRC())
 			{
-				if (not msgTask)
+				Log(EUnit::gate, "Incoming Gateway Packet failed CRC check:\n");
+				Dump(nullptr, buf, length);
+			} else {
+				const CCallsign dst(p->GetCDstAddress());
+				if (dst == thisCS)
 				{
-					auto message = voiceQueue.Pop();
-					Log(EUnit::gate, "Playing message '%s'\n", message.c_str());
-					msgTask = std::make_unique<SMessageTask>();
-					msgTask->isDone = false;
-					msgTask->futTask = std::async(std::launch::async, &CGateway::PlayVoiceFiles, this, message);
+					memset(p->GetDstAddress(), 0xffu, 6);
+					p->CalcCRC();
 				}
+				sendPacket2Modem(std::move(p));
 			}
 		}
+		break;
+	}
+}
 
-		// any packets from IPv4 or 6?
-		auto rval = poll(pfds, 2, 10);
-		if (0 > rval)
-		{
-			Log(EUnit::gate, "gateway poll() error: %s\n", strerror(errno));
-			return;
-		}
+// the coded destination of p, so it can be decoded again once its stream has ended
+static std::array<uint8_t, 6> dstCode(const std::unique_ptr<CPacket> &p)
+{
+	std::array<uint8_t, 6> code;
+	memcpy(code.data(), p->GetCDstAddress(), 6);
+	return code;
+}
 
-		uint8_t buf[MAX_PACKET_SIZE];
-		socklen_t fromlen = sizeof(struct sockaddr_storage);
-		int length = 0;
+void CGateway::onModem()
+{
+	while (auto p = Modem2Gate.Pop())
+	{
+		// an RF command gets the rest of its stream
+		if (ERfCmd::none != rfCmd.type)
+			rfCommandPacket(p);
+		else
+			processModem(p);
+	}
+}
 
-		if (rval)	// receive any packet
+void CGateway::processModem(std::unique_ptr<CPacket> &p)
+{
+	const CCallsign dst(p->GetCDstAddress());
+	if (EPacketType::packet == p->GetType()) { // process packet data
+		switch (mlink.state)
 		{
-			if (pfds[0].revents & POLLIN)
-			{
-				length = recvfrom(pfds[0].fd, buf, MAX_PACKET_SIZE, 0, from17k.GetPointer(), &fromlen);
-				pfds[0].revents &= ~POLLIN;
+		case ELinkState::linked:
+			if ((dst == mlink.cs) or (not dst.IsReflector())) { // is the destination the linked reflector?
+				sendPacket2Dest(std::move(p));
+			} else {
+				Log(EUnit::gate, "Destination is %s but you are already linked to %s\n", dst.c_str(), mlink.cs.c_str());
 			}
-			else if (pfds[1].revents & POLLIN)
-			{
-				length = recvfrom(pfds[1].fd, buf, MAX_PACKET_SIZE, 0, from17k.GetPointer(), &fromlen);
-				pfds[1].revents &= ~POLLIN;
+			break;
+		case ELinkState::linking:
+			if (dst == mlink.cs) {
+				Log(EUnit::gate, "%s is not yet linked", dst.c_str());
+			} else {
+				Log(EUnit::gate, "Destination is %s but you are linking to %s\n", dst.c_str(), mlink.cs.c_str());
 			}
-
-			for (unsigned i=0; i<2; i++)	// check for errors
-			{
-				if (pfds[i].revents)
-				{
-					Log(EUnit::gate, "poll() returned revents %d from IPv%s port\n", pfds[i].revents, i ? '6' : '4');
-					return;
+			break;
+		case ELinkState::unlinked:
+			if (dst.IsReflector()) {
+				findDestination(dst, [this]() {
+					if (mlink.isReflector)
+						mlink.state = ELinkState::linking;
+					else
+						Log(EUnit::gate, "IP Address for %s found: %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
+				});
+			} else {
+				if (dst == mlink.cs) {
+					sendPacket2Dest(std::move(p));
+				} else {
+					findDestination(dst, [this]() {
+						Log(EUnit::gate, "IP Address for %s found: %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
+					});
 				}
 			}
+			break;
 		}
-
-		if (length)
+	} else if (EPacketType::stream == p->GetType()) {
+		// the RF commands set the state back to idle when they're done
+		switch (dst.GetBase())
 		{
-			switch (length)	// process known packets
+		case CalcCSCode("E"):
+		case CalcCSCode("ECHO"):
+			doEcho(p);
+			break;
+		case CalcCSCode("I"):
+		case CalcCSCode("S"):
+		case CalcCSCode("STATUS"):
+			doStatus(p);
+			break;
+		case CalcCSCode("U"):
+		case CalcCSCode("UNLINK"):
+			doUnlink(p);
+			break;
+		case CalcCSCode("RECORD"):
+			doRecord(p);
+			break;
+		case CalcCSCode("PLAY"):
+			doPlay(p);
+			break;
+		default:
+			switch (mlink.state)
 			{
-			case 4:  				// DISC, ACKN or NACK
-				if ((ELinkState::unlinked != mlink.state) and (from17k == mlink.addr))
-				{
-					if (0 == memcmp(buf, "ACKN", 4))
-					{
-						mlink.state = ELinkState::linked;
-						makeCSData(mlink.cs, "destination.dat");
-						addMessage("repeater is_linked_to destination");
-						Log(EUnit::gate, "Connected to %s at %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
-						mlink.receivePingTimer.start();
-						dataBase.UpdateLS(mlink.addr.GetAddress(), mlink.addr.GetPort(), mlink.cs.c_str());
-					}
-					else if (0 == memcmp(buf, "NACK", 4))
-					{
-						addMessage("link_refused");
-						Log(EUnit::gate, "Connection request refused from %s\n", mlink.cs.c_str());
-						mlink.cs.Clear();
-						mlink.addr.Clear();
-						mlink.state = ELinkState::unlinked;
-					}
-					else if (0 == memcmp(buf, "DISC", 4))
-					{
-						addMessage("repeater is_unlinked");
-						Log(EUnit::gate, "Disconnected from %s at %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
-						mlink.addr.Clear(); // initiated with UNLINK, so don't try to reconnect
-						mlink.cs.Clear();   // ^^^^^^^^^ ^^^^ ^^^^^^
-						dataBase.ClearTable("linkstatus");
-						mlink.state = ELinkState::unlinked;
-					}
-					else
-					{
-						Log(EUnit::gate, "Unknown Packet:\n");
-						Dump(nullptr, buf, length);
-					}
-				}
-				else
-				{
-					Log(EUnit::gate, "Unknown Packet:\n");
-					Dump(nullptr, buf, length);
-				}
-				break;
-			case 10: 				// PING or DISC
-				if ((ELinkState::linked == mlink.state) and (from17k == mlink.addr))
-				{
-					if (0 == memcmp(buf, "PING", 4))
-					{
-						sendPacket(mlink.pongPacket.magic, 10, mlink.addr);
-						mlink.receivePingTimer.start();
-					}
-					else if (0 == memcmp(buf, "DISC", 4))
-					{
-						const CCallsign from(buf+4);
-						if (from == mlink.cs)
-						{
-							addMessage("repeater was_disconnected_from destination");
-							mlink.state = ELinkState::unlinked;
-							if (not mlink.maintainLink)
-								mlink.addr.Clear();
-							dataBase.ClearTable("linkstatus");
-							Log(EUnit::gate, "%s initiated a disconnect\n", from.GetCS().c_str());
-						}
-						else
-							Log(EUnit::gate, "Got a bogus disconnect from '%s' @ %s\n", from.GetCS().c_str(), from17k.GetAddress());
-					}
-					else
-					{
-						Log(EUnit::gate, "Unknown Packet:\n");
-						Dump(nullptr, buf, length);
-					}
+			case ELinkState::linked:
+				if ((dst == mlink.cs) or (not dst.IsReflector())) { // is the destination the linked reflector?
+					sendPacket2Dest(std::move(p));
+				} else {
+					addMessage("repeater is_already_linked");
+					Log(EUnit::gate, "Destination is %s but you are already linked to %s\n", dst.c_str(), mlink.cs.c_str());
+					wait4end(p, []() { g_GateState.Idle(); });
 				}
 				break;
-			default:
-				auto t = validate(buf, length);
-				if (EPacketType::none == t)
-				{
-					Log(EUnit::gate, "Unknown Packet:\n");
-					Dump(nullptr, buf, length);
+			case ELinkState::linking:
+				if (dst == mlink.cs) {
+					Log(EUnit::gate, "%s is not yet linked", dst.c_str());
 				} else {
-					auto p = std::make_unique<CPacket>();
-					p->Initialize(t, buf, length);
-					if (p->CheckCRC())
-					{
-						Log(EUnit::gate, "Incoming Gateway Packet failed CRC check:\n");
-						Dump(nullptr, buf, length);
-					} else {
-						const CCallsign dst(p->GetCDstAddress());
-						if (dst == thisCS)
-						{
-							memset(p->GetDstAddress(), 0xffu, 6);
-							p->CalcCRC();
-						}
-						sendPacket2Modem(std::move(p));
-					}
+					addMessage("repeater is_already_linking");
+					Log(EUnit::gate, "Destination is %s but you are linking to %s\n", dst.c_str(), mlink.cs.c_str());
 				}
+				wait4end(p, []() { g_GateState.Idle(); });
 				break;
-			}
-		}
-
-		// check for a stream timeout
-		if (gateStream.IsOpen() and gateStream.GetLastTime() >= 1.6)
-		{
-			gateStream.CloseStream(true, dataBase);
-			g_GateState.Idle();
-		}
-
-		// finally, if we can, send a saved PM data. It should already be in the lastheard.
-		if (not pmQueue.IsEmpty() and g_GateState.SetStateToOnlyIfFrom(EGateState::gatepacketin, EGateState::idle))
-		{
-			auto p = pmQueue.PopWait();
-			Gate2Modem.Push(p);
-		}
-	}
-}
-
-void CGateway::processModem()
-{
-	while (keep_running)
-	{
-		auto p = Modem2Gate.PopWaitFor(40);
-		if (p) {
-			const CCallsign dst(p->GetCDstAddress());
-			if (EPacketType::packet == p->GetType()) { // process packet data
-				switch (mlink.state)
-				{
-				case ELinkState::linked:
-					if ((dst == mlink.cs) or (not dst.IsReflector())) { // is the destination the linked reflector?
-						sendPacket2Dest(std::move(p));
-					} else {
-						Log(EUnit::gate, "Destination is %s but you are already linked to %s\n", dst.c_str(), mlink.cs.c_str());
-					}
-					break;
-				case ELinkState::linking:
-					if (dst == mlink.cs) {
-						Log(EUnit::gate, "%s is not yet linked", dst.c_str());
-					} else {
-						Log(EUnit::gate, "Destination is %s but you are linking to %s\n", dst.c_str(), mlink.cs.c_str());
-					}
-					break;
-				case ELinkState::unlinked:
-					if (dst.IsReflector()) {
-						if (not setDestination(dst))
-						{
+			case ELinkState::unlinked:
+				if (dst.IsReflector()) {
+					wait4end(p, [this, code = dstCode(p)]() {
+						findDestination(CCallsign(code.data()), [this]() {
 							if (mlink.isReflector)
 								mlink.state = ELinkState::linking;
 							else
-								Log(EUnit::gate, "IP Address for %s found: %s\n", dst.c_str(), mlink.addr.GetAddress());
-						}
-					} else {
-						if (dst == mlink.cs) {
-							sendPacket2Dest(std::move(p));
-						} else {
-							if (not setDestination(dst))
-							{
-								Log(EUnit::gate, "IP Address for %s found: %s\n", dst.c_str(), mlink.addr.GetAddress());
-							}
-						}
-					}
-					break;
-				}
-			} else if (EPacketType::stream == p->GetType()) {
-				switch (dst.GetBase())
-				{
-				case CalcCSCode("E"):
-				case CalcCSCode("ECHO"):
-					doEcho(p);
-					g_GateState.Idle();
-					break;
-				case CalcCSCode("I"):
-				case CalcCSCode("S"):
-				case CalcCSCode("STATUS"):
-					doStatus(p);
-					g_GateState.Idle();
-					break;
-				case CalcCSCode("U"):
-				case CalcCSCode("UNLINK"):
-					doUnlink(p);
-					g_GateState.Idle();
-					break;
-				case CalcCSCode("RECORD"):
-					doRecord(p);
-					g_GateState.Idle();
-					break;
-				case CalcCSCode("PLAY"):
-					doPlay(p);
-					g_GateState.Idle();
-					break;
-				default:
-					switch (mlink.state)
-					{
-					case ELinkState::linked:
-						if ((dst == mlink.cs) or (not dst.IsReflector())) { // is the destination the linked reflector?
-							sendPacket2Dest(std::move(p));
-						} else {
-							addMessage("repeater is_already_linked");
-							wait4end(p);
-							Log(EUnit::gate, "Destination is %s but you are already linked to %s\n", dst.c_str(), mlink.cs.c_str());
-							g_GateState.Idle();
-						}
-						break;
-					case ELinkState::linking:
-						wait4end(p);
-						if (dst == mlink.cs) {
-							Log(EUnit::gate, "%s is not yet linked", dst.c_str());
-						} else {
-							addMessage("repeater is_already_linking");
-							Log(EUnit::gate, "Destination is %s but you are linking to %s\n", dst.c_str(), mlink.cs.c_str());
-						}
+								Log(EUnit::gate, "IP Address for %s found: %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
+						});
 						g_GateState.Idle();
-						break;
-					case ELinkState::unlinked:
-						if (dst.IsReflector()) {
-							wait4end(p);
-							if (not setDestination(dst))
-							{
-								if (mlink.isReflector)
-									mlink.state = ELinkState::linking;
-								else
-									Log(EUnit::gate, "IP Address for %s found: %s\n", dst.c_str(), mlink.addr.GetAddress());
-							}
-							g_GateState.Idle();
-						} else {
-							if (dst == mlink.cs) {
-								sendPacket2Dest(std::move(p));
-							} else {
-								wait4end(p);
-								if (not setDestination(dst))
-								{
-									Log(EUnit::gate, "IP Address for %s found: %s\n", dst.c_str(), mlink.addr.GetAddress());
-								}
-							}
-						}
-						break;
+					});
+				} else {
+					if (dst == mlink.cs) {
+						sendPacket2Dest(std::move(p));
+					} else {
+						wait4end(p, [this, code = dstCode(p)]() {
+							findDestination(CCallsign(code.data()), [this]() {
+								Log(EUnit::gate, "IP Address for %s found: %s\n", mlink.cs.c_str(), mlink.addr.GetAddress());
+							});
+						});
 					}
-					break;
 				}
+				break;
 			}
-		} else {
-			// check for a timeout from the modem
-			if (modemStream.IsOpen() and modemStream.GetLastTime() >= 1.0)
-			{
-				modemStream.CloseStream(true, dataBase); // close the modemStream
-				g_GateState.Idle();
-			}
-			if (g_GateState.SetStateToOnlyIfFrom(EGateState::idle, EGateState::rftimeout))
-				Log(EUnit::gate, "Reset state to idle from RF timeout\n");
+			break;
 		}
 	}
 }
@@ -615,7 +651,7 @@ void CGateway::sendPacket2Modem(std::unique_ptr<CPacket> p)
 			from.assign("Direct");
 		unsigned fc = p->GetSize()-34u;
 		fc = fc / 25 + ((fc % 25) ? 2 : 1);
-		dataBase.UpdateLH(src.c_str(), dst.c_str(), false, from.c_str(), fc);
+		worker.Post([this, s = std::string(src.c_str()), d = std::string(dst.c_str()), from, fc]() { dataBase.UpdateLH(s.c_str(), d.c_str(), false, from.c_str(), fc); });
 		if (g_GateState.TryState(EGateState::gatepacketin))
 			Gate2Modem.Push(p);
 		else
@@ -637,7 +673,7 @@ void CGateway::sendPacket2Modem(std::unique_ptr<CPacket> p)
 				auto maidenhead = position.GetPosition(la, lo);
 				if (maidenhead) {
 					const CCallsign src(p->GetCSrcAddress());
-					dataBase.UpdatePosition(src.c_str(), maidenhead, la, lo);
+					worker.Post([this, s = std::string(src.c_str()), m = std::string(maidenhead), la, lo]() { dataBase.UpdatePosition(s.c_str(), m.c_str(), la, lo); });
 					//Log(EUnit::cc12, "Position for %s: lat=%.5f lon=%.5f Station=%s Source=%s\n", src.c_str(), la, lo, position.GetStation(), position.GetSource());
 				}
 			}
@@ -645,10 +681,7 @@ void CGateway::sendPacket2Modem(std::unique_ptr<CPacket> p)
 			auto islast = p->IsLastPacket();
 			Gate2Modem.Push(p);
 			if (islast)
-			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(2));
-				gateStream.CloseStream(false, dataBase); // close the stream
-			}
+				closeStream(gateStream, false);
 		}
 	}
 	else
@@ -672,13 +705,18 @@ void CGateway::sendPacket2Modem(std::unique_ptr<CPacket> p)
 		{
 			const CCallsign src(p->GetCSrcAddress());
 			const CCallsign dst(p->GetCDstAddress());
+			const std::string s(src.c_str()), d(dst.c_str());
 			if (from17k == mlink.addr) {
-				gateStream.OpenStream(src.c_str(), sid, mlink.cs.c_str());
-				dataBase.UpdateLH(src.c_str(), dst.c_str(), true, mlink.cs.c_str());
+				gateStream.OpenStream(s, sid, mlink.cs.c_str());
+				worker.Post([this, s, d, from = std::string(mlink.cs.c_str())]() { dataBase.UpdateLH(s.c_str(), d.c_str(), true, from.c_str()); });
 			} else {
-				dataBase.UpdateGW(src.GetCS(), from17k);
-				gateStream.OpenStream(src.c_str(), sid, from17k.GetAddress());
-				dataBase.UpdateLH(src.c_str(), dst.c_str(), true, "Direct");
+				gateStream.OpenStream(s, sid, from17k.GetAddress());
+				auto addr = std::make_shared<CSockAddress>();
+				*addr = from17k;
+				worker.Post([this, s, d, cs = src.GetCS(), addr]() {
+					dataBase.UpdateGW(cs, *addr);
+					dataBase.UpdateLH(s.c_str(), d.c_str(), true, "Direct");
+				});
 			}
 			Gate2Modem.Push(p);
 			gateStream.CountnTouch();
@@ -707,7 +745,7 @@ void CGateway::sendPacket2Dest(std::unique_ptr<CPacket> p)
 		auto fc = p->GetSize();
 		sendPacket(p->GetCData(), fc, mlink.addr);
 		fc = fc / 25 + ((fc % 25) ? 2 : 1);
-		dataBase.UpdateLH(src.c_str(), dst.c_str(), false, "CC1200", fc);
+		worker.Post([this, s = std::string(src.c_str()), d = std::string(dst.c_str()), fc]() { dataBase.UpdateLH(s.c_str(), d.c_str(), false, "CC1200", fc); });
 		g_GateState.Idle();
 		return;
 	}
@@ -726,15 +764,15 @@ void CGateway::sendPacket2Dest(std::unique_ptr<CPacket> p)
 				auto maidenhead = position.GetPosition(la, lo);
 				if (maidenhead) {
 					const CCallsign src(p->GetCSrcAddress());
-					dataBase.UpdatePosition(src.c_str(), maidenhead, la, lo);
+					worker.Post([this, s = std::string(src.c_str()), m = std::string(maidenhead), la, lo]() { dataBase.UpdatePosition(s.c_str(), m.c_str(), la, lo); });
 					//Log(EUnit::cc12, "Pos'tion for %s: lat=%.5f lon=%.5f Station=%s Source=%s\n", src.c_str(), la, lo, position.GetStation(), position.GetSource());
 				}
 			}
-			sendPacket(p->GetCData(), p->GetSize(), mlink.addr);
+			sendPacket(p->GetCData(), p->GetSize(), mlink.addr, DSCP_EF);
 			modemStream.CountnTouch();
 			if (islast)
 			{
-				modemStream.CloseStream(false, dataBase);
+				closeStream(modemStream, false);
 				g_GateState.Idle();
 			}
 		}
@@ -757,50 +795,79 @@ void CGateway::sendPacket2Dest(std::unique_ptr<CPacket> p)
 		const CCallsign dst(p->GetCDstAddress());
 		const CCallsign src(p->GetCSrcAddress());
 		modemStream.OpenStream(src.c_str(), framesid, "CC1200");
-		sendPacket(p->GetCData(), p->GetSize(), mlink.addr);
-		dataBase.UpdateLH(src.c_str(), dst.c_str(), true, "CC1200");
+		sendPacket(p->GetCData(), p->GetSize(), mlink.addr, DSCP_EF);
+		worker.Post([this, s = std::string(src.c_str()), d = std::string(dst.c_str())]() { dataBase.UpdateLH(s.c_str(), d.c_str(), true, "CC1200"); });
 		modemStream.CountnTouch();
 	}
 }
 
-void CGateway::sendPacket(const void *buf, const size_t size, const CSockAddress &addr) const
+// it's queued on the socket, housekeeping() sends it
+void CGateway::sendPacket(const void *buf, const size_t size, const CSockAddress &addr, unsigned dscp)
 {
 	if (AF_INET ==  addr.GetFamily())
-		ipv4.Write(buf, size, addr);
+		ipv4.Queue(buf, size, addr, dscp);
 	else
-		ipv6.Write(buf, size, addr);
+		ipv6.Queue(buf, size, addr, dscp);
 }
 
 // returns false if successful
 bool CGateway::setDestination(const std::string &callsign)
 {
 	const CCallsign cs(callsign);
-	return setDestination(cs);
+	CSockAddress addr;
+	std::string mods, smods;
+	if (lookupTarget(cs, addr, mods, smods))
+		return true;
+	useTarget(cs, addr, mods, smods);
+	return false;
+}
+
+void CGateway::findDestination(const CCallsign &cs, std::function<void()> found)
+{
+	worker.Post([this, callsign = std::string(cs.c_str()), found]() {
+		const CCallsign cs(callsign);
+		auto addr = std::make_shared<CSockAddress>();
+		auto mods = std::make_shared<std::string>(), smods = std::make_shared<std::string>();
+		if (lookupTarget(cs, *addr, *mods, *smods))
+			return;
+		toLoop([this, callsign, addr, mods, smods, found]() {
+			// something else could have set up a link while we looked
+			if (ELinkState::unlinked != mlink.state)
+				return;
+			useTarget(CCallsign(callsign), *addr, *mods, *smods);
+			found();
+		});
+	});
 }
 
 // returns true on error
-bool CGateway::setDestination(const CCallsign &cs)
+bool CGateway::lookupTarget(const CCallsign &cs, CSockAddress &addr, std::string &mods, std::string &smods)
 {
 	char target[9] { 0 };
 	memcpy(target, cs.c_str(), 8); // don't want the module
 	unsigned pos = 7;
 	while ((' ' == target[pos]) and pos)
 		target[pos--] = 0;
-	std::string address, mods, smods;
+	std::string address;
 	uint16_t port;
 	if (dataBase.GetTarget(target, address, mods, smods, port))
 	{
-		mlink.addr.Initialize(address, port);
-		mlink.cs = cs;
-		mlink.mods.assign(mods);
-		mlink.smods.assign(smods);
-		mlink.isReflector = cs.IsReflector();
+		addr.Initialize(address, port);
 		return false;
 	}
 	Log(EUnit::gate, "Host '%s' not found\n", cs.c_str());
 	return true;
 }
 
+void CGateway::useTarget(const CCallsign &cs, const CSockAddress &addr, const std::string &mods, const std::string &smods)
+{
+	mlink.addr = addr;
+	mlink.cs = cs;
+	mlink.mods.assign(mods);
+	mlink.smods.assign(smods);
+	mlink.isReflector = cs.IsReflector();
+}
+
 void CGateway::addMessage(const std::string &message)
 {
 	voiceQueue.Push(message);
@@ -890,7 +957,7 @@ void CGateway::makeCSData(const CCallsign &cs, const std::string &ofileName)
 			Log(EUnit::gate, "adding quiet (for ' ' at position %u)\n", pos);
 			// insert 200 millisecond of quiet, this is a ' ' in the callsign (very rare)
 			for (int n=0; n<10; n++)
-				ofile.write(reinterpret_cast<const char *>(quiet), 8);
+				ofile.write(reinterpret_cast<const char *>(c2_quiet), 8);
 		}
 		else
 		{
@@ -905,7 +972,7 @@ void CGateway::makeCSData(const CCallsign &cs, const std::string &ofileName)
 			}
 			// add 60 ms of quiet between each word
 			for (unsigned n=0; n<3; n++)
-				ofile.write(reinterpret_cast<const char *>(quiet), 8);
+				ofile.write(reinterpret_cast<const char *>(c2_quiet), 8);
 		}
 		// loop back for the next char in the callsign base
 	}
@@ -929,7 +996,8 @@ void CGateway::makeCSData(const CCallsign &cs, const std::string &ofileName)
 	ofile.close();
 }
 
-unsigned CGateway::PlayVoiceFiles(std::string message)
+// Build the message's frames, they go out on the voice timer
+void CGateway::PlayVoiceFiles(const std::string &message, uint16_t sid)
 {
 	CFrameType ft;
 	ft.SetPayloadType(EPayloadType::c2_3200);
@@ -942,12 +1010,12 @@ unsigned CGateway::PlayVoiceFiles(std::string message)
 	// we'll still need to add the payload, frame counter and the CRC before sending it to the modem.
 	CPacket master;
 	master.Initialize(EPacketType::stream, 54);
-	master.SetStreamId(g_RNG.Get());
+	master.SetStreamId(sid);
 	memset(master.GetDstAddress(), 0xffu, 6); // set destination to BROADCAST
 	thisCS.CodeOut(master.GetSrcAddress());
 	master.SetFrameType(ft.GetFrameType(radioTypeIsV3 ? EVersionType::v3 : EVersionType::legacy));
 
-	auto clock = std::chrono::steady_clock::now(); // start the packet clock
+	std::queue<SStreamFrame> frames;
 	std::ifstream ifile;
 
 	std::queue<std::string> words;
@@ -960,19 +1028,16 @@ unsigned CGateway::PlayVoiceFiles(std::string message)
 	{
 		if (count % 2)
 		{	// counter is odd, put this in the second half
-			memcpy(master.GetPayload(false), quiet, 8);
+			memcpy(master.GetPayload(false), c2_quiet, 8);
 			uint16_t fn = ((count / 2u) % 0x8000u);
 			master.SetFrameNumber(fn);
 			master.CalcCRC();
-			auto p = std::make_unique<CPacket>();
-			p->Initialize(EPacketType::stream, master.GetCData());
-			clock = clock + std::chrono::milliseconds(40);
-			std::this_thread::sleep_until(clock);
-			Gate2Modem.Push(p);
+			frames.emplace();
+			memcpy(frames.back().data(), master.GetCData(), 54);
 		}
 		else
 		{	// counter is even, this goes in the first half
-			memcpy(master.GetPayload(), quiet, 8);
+			memcpy(master.GetPayload(), c2_quiet, 8);
 		}
 		count++;
 	}
@@ -1018,11 +1083,8 @@ unsigned CGateway::PlayVoiceFiles(std::string message)
 				master.CalcCRC(); // seal it with the CRC
 
 				// make the packet to pass to the modem
-				auto p = std::make_unique<CPacket>();
-				p->Initialize(EPacketType::stream, master.GetCData());
-				clock = clock + std::chrono::milliseconds(40);
-				std::this_thread::sleep_until(clock); // the frames will go out every 40 milliseconds
-				Gate2Modem.Push(p);
+				frames.emplace();
+				memcpy(frames.back().data(), master.GetCData(), 54); // the frames will go out every 40 milliseconds
 			}
 			else
 			{	// counter is even, this is the first 20 ms of C2_3200 data
@@ -1038,19 +1100,16 @@ unsigned CGateway::PlayVoiceFiles(std::string message)
 			{
 				if (count % 2)
 				{	// counter is odd, put this in the second half
-					memcpy(master.GetPayload(false), quiet, 8);
+					memcpy(master.GetPayload(false), c2_quiet, 8);
 					uint16_t fn = ((count / 2u) % 0x8000u);
 					master.SetFrameNumber(fn);
 					master.CalcCRC();
-					auto p = std::make_unique<CPacket>();
-					p->Initialize(EPacketType::stream, master.GetCData());
-					clock = clock + std::chrono::milliseconds(40);
-					std::this_thread::sleep_until(clock);
-					Gate2Modem.Push(p);
+					frames.emplace();
+					memcpy(frames.back().data(), master.GetCData(), 54);
 				}
 				else
 				{	// counter is even, this goes in the first half
-					memcpy(master.GetPayload(), quiet, 8);
+					memcpy(master.GetPayload(), c2_quiet, 8);
 				}
 				count++;
 			}
@@ -1058,24 +1117,84 @@ unsigned CGateway::PlayVoiceFiles(std::string message)
 	}
 	if (count % 2) // if this is true, we need to complete and send the last packet
 	{
-		memcpy(master.GetPayload(false), quiet, 8);
+		memcpy(master.GetPayload(false), c2_quiet, 8);
 		uint16_t fn = ((count %0x8000u) / 2u) + 0x8000u;
 		master.SetFrameNumber(fn);
 		master.CalcCRC();
+		frames.emplace();
+		memcpy(frames.back().data(), master.GetCData(), 54);
+	}
+	// 200 ms after the last frame, the message is done
+	auto f = std::make_shared<std::queue<SStreamFrame>>(std::move(frames));
+	toLoop([this, f, count]() {
+		play(std::move(*f), 5u, [this, count]() {
+			Log(EUnit::gate, "Played %.2f sec message\n", (count / 2u) * 0.04f);
+			if ((EGateState::bootup != g_GateState.GetState()) or voiceQueue.Empty())
+				g_GateState.Idle();
+		});
+	});
+}
+
+void CGateway::play(std::queue<SStreamFrame> &&frames, unsigned tail, std::function<void()> done)
+{
+	voice.frames = std::move(frames);
+	voice.tail = tail;
+	voice.done = std::move(done);
+	voice.active = true;
+	g_EventLoop.SetTimer(voiceTimer, 40u, 40u);
+}
+
+void CGateway::onVoiceTick()
+{
+	if (not voice.active)
+		return;
+	if (not voice.frames.empty())
+	{
 		auto p = std::make_unique<CPacket>();
-		p->Initialize(EPacketType::stream, master.GetCData());
-		clock = clock + std::chrono::milliseconds(40);
-		std::this_thread::sleep_until(clock);
+		p->Initialize(EPacketType::stream, voice.frames.front().data());
+		voice.frames.pop();
 		Gate2Modem.Push(p);
+		return;
+	}
+	if (voice.tail)
+	{
+		voice.tail--;
+		return;
 	}
-	std::this_thread::sleep_for(std::chrono::milliseconds(200));
-	// this thread can be harvested
-	msgTask->isDone = true;
-	// return the number of packets sent
-	return count / 2u;
+	g_EventLoop.SetTimer(voiceTimer, 0);
+	voice.active = false;
+	auto done = std::move(voice.done);
+	voice.done = nullptr;
+	if (done)
+		done();
+}
+
+void CGateway::later(unsigned ms, std::function<void()> fn)
+{
+	laterFn = std::move(fn);
+	g_EventLoop.SetTimer(laterTimer, std::max(1u, ms));
+}
+
+void CGateway::toLoop(std::function<void()> fn)
+{
+	// Stop() clears running before it removes the timers, so fn can't use one that's gone
+	g_EventLoop.Post([this, fn]() {
+		if (running)
+		{
+			fn();
+			housekeeping();
+		}
+	});
+}
+
+void CGateway::closeStream(CStream &stream, bool isTimeout)
+{
+	const std::string src(stream.GetSource());
+	const auto count = stream.CloseStream(isTimeout);
+	worker.Post([this, src, count]() { dataBase.UpdateLH(src.c_str(), count); });
 }
 
-EPacketType CGateway::validate(uint8_t *in, unsigned length)
+EPacketType CGateway::validate(const uint8_t *in, unsigned length)
 {
 	if (0 == memcmp(in, "M17", 3))
 	{
@@ -19,9 +19,10 @@
 #pragma once
 
 #include <filesystem>
+#include <array>
 #include <atomic>
 #include <string>
-#include <future>
+#include <functional>
 #include <vector>
 #include <mutex>
 #include <queue>
@@ -36,6 +37,7 @@
 #include "MspotDB.h"
 #include "Packet.h"
 #include "Stream.h"
+#include "Worker.h"
 #include "Base.h"
 
 enum class ELinkState { unlinked, linking, linked };
@@ -95,15 +97,37 @@ public:
 	}
 };
 
-using SMessageTask = struct message_tag
+// an RF command that's still collecting the stream that carried it
+enum class ERfCmd { none, wait4end, record };
+
+using SRfCommand = struct rfcommand_tag
+{
+	ERfCmd type = ERfCmd::none;
+	uint16_t sid, fn;
+	char module;
+	CSteadyTimer timer;
+	std::function<void()> then;
+};
+
+// the bytes of a stream frame
+using SStreamFrame = std::array<uint8_t, 54>;
+
+// a voice stream from the gateway, one frame goes to the modem on every tick of the voice timer,
+// it's only made into a CPacket then, so a long recording doesn't empty the packet pool
+using SVoicePlay = struct voiceplay_tag
 {
-	std::future<unsigned> futTask;
-	std::atomic<bool> isDone;
+	std::queue<SStreamFrame> frames;
+	unsigned tail = 0;
+	bool active = false;
+	std::function<void()> done;
 };
 
 class CGateway : public CBase, public CLineTools
 {
 public:
+	// Open the database and the sockets and make repeater.dat, it can run while the modem starts, returns true on error
+	bool Prepare();
+	// Add the sockets, the timers and the modem's queue to the event loop, Prepare() has to have succeeded, returns true on error
 	bool Start();
 	void Stop();
 	void SetName(const std::string &name) { progName.assign(name); }
@@ -117,41 +141,72 @@ private:
 	std::string audioPath;
 	bool radioTypeIsV3;
 	EInternetType internetType;
-	std::atomic<bool> keep_running;
 	CUDPSocket ipv4, ipv6;
 	SM17Link mlink;
 	CSteadyTimer linkingTime, lastLinkSent;
 	CStream gateStream, modemStream;
 	CSockAddress from17k;
 	CMspotDB dataBase;
-	std::future<void> gateFuture, modemFuture;
 	CSafeMessageQueue voiceQueue;
 	IPFrameFIFO pmQueue;
-	std::unique_ptr<SMessageTask> msgTask;
 	std::queue<CPayload> playbackQueue;
-
-	void processGateway();
-	EPacketType validate(uint8_t *in, unsigned length);
-	void sendPacket(const void *buf, const size_t size, const CSockAddress &addr) const;
+	// where the next batch of datagrams is received
+	std::array<std::unique_ptr<CPacket>, UDP_BATCH_MAX> rxPkts;
+	// everything runs on the event loop, these are its timers and the notifier for Modem2Gate and g_GateState
+	int houseTimer = -1, voiceTimer = -1, laterTimer = -1, notifier = -1;
+	std::function<void()> laterFn;
+	SRfCommand rfCmd;
+	SVoicePlay voice;
+	// the database writes and the file work, so they don't hold up the event loop
+	CWorker worker;
+	std::atomic<bool> running { false };
+
+	void onSocket(CUDPSocket &sock, uint32_t events);
+	void processDatagram(std::unique_ptr<CPacket> &p, int length);
+	void onModem();
+	void onVoiceTick();
+	// link maintenance, timeouts and starting what's waiting, then arm houseTimer for the next deadline
+	void housekeeping();
+	// send the frames to the modem, one every 40 ms, then after tail ticks call done
+	void play(std::queue<SStreamFrame> &&frames, unsigned tail, std::function<void()> done);
+	// call fn in ms, from the event loop
+	void later(unsigned ms, std::function<void()> fn);
+	// from the worker, call fn on the event loop, unless the gateway has stopped
+	void toLoop(std::function<void()> fn);
+	// close the stream and update its last heard on the worker
+	void closeStream(CStream &stream, bool isTimeout);
+	void rfCommandPacket(std::unique_ptr<CPacket> &p);
+	void endRfCommand();
+	EPacketType validate(const uint8_t *in, unsigned length);
+	// voice frames are marked with dscp = DSCP_EF
+	void sendPacket(const void *buf, const size_t size, const CSockAddress &addr, unsigned dscp = 0);
 	void sendPacket2Modem(std::unique_ptr<CPacket>);
 	void sendPacket2Dest(std::unique_ptr<CPacket>);
-	void processModem();
+	void processModem(std::unique_ptr<CPacket> &p);
 	void sendLinkRequest();
-	// returns true on error
+	// returns true on error, this waits on the database, so it's only for Prepare()
 	bool setDestination(const std::string &cs);
-	// returns true on error
-	bool setDestination(const CCallsign &cs);
+	// look cs up on the worker, then, if the link is still down, make it the destination and call found
+	void findDestination(const CCallsign &cs, std::function<void()> found);
+	// returns true if cs isn't in the database
+	bool lookupTarget(const CCallsign &cs, CSockAddress &addr, std::string &mods, std::string &smods);
+	void useTarget(const CCallsign &cs, const CSockAddress &addr, const std::string &mods, const std::string &smods);
 	void addMessage(const std::string &message);
 	void makeCSData(const CCallsign &cs, const std::string &ofileName);
-	unsigned PlayVoiceFiles(std::string message);
+	// on the worker, build the message's frames and hand them to play()
+	void PlayVoiceFiles(const std::string &message, uint16_t sid);
 
 	// for executing rf based commands!
 	void doUnlink(std::unique_ptr<CPacket> &);
 	void doEcho(std::unique_ptr<CPacket> &);
 	void doRecord(std::unique_ptr<CPacket> &);
 	void doRecord(char, uint16_t);
+	void saveRecording();
 	void doPlay(std::unique_ptr<CPacket> &);
 	void doPlay(char c);
+	// on the worker, read a recording and hand its frames to play()
+	void readRecording(const std::filesystem::path &pathname, uint16_t sid);
 	void doStatus(std::unique_ptr<CPacket> &);
-	void wait4end(std::unique_ptr<CPacket> &);
+	// then is called once the stream p started has ended
+	void wait4end(std::unique_ptr<CPacket> &p, std::function<void()> then);
 };
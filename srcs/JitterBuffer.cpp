@@ -0,0 +1,196 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include "JitterBuffer.h"
+#include "FrameType.h"
+
+// the distance from a to b, going forward, in 15 bit frame numbers
+static inline uint16_t ahead(uint16_t a, uint16_t b)
+{
+	return (b - a) & 0x7fffu;
+}
+
+// anything more than half way around is behind
+static inline bool isAhead(uint16_t a, uint16_t b)
+{
+	return ahead(a, b) < 0x4000u;
+}
+
+void CJitterBuffer::Configure(unsigned t, unsigned m)
+{
+	max = (m < 1u) ? 1u : ((m > JITTER_MAX_DEPTH) ? JITTER_MAX_DEPTH : m);
+	cfgTarget = (t > max) ? max : t;
+	Reset();
+}
+
+void CJitterBuffer::Reset()
+{
+	for (auto &s : slots)
+		s.reset();
+	started = playing = haveLast = havePlayed = false;
+	sid = next = newest = 0;
+	target = cfgTarget;
+	stats = SJitterStats {};
+}
+
+bool CJitterBuffer::Push(std::unique_ptr<CPacket> &p)
+{
+	const uint16_t fn = p->GetFrameNumber() & 0x7fffu;
+	if (not started or sid != p->GetStreamId())
+	{
+		// the first frame, or the gateway switched streams, so start the numbering over
+		for (auto &s : slots)
+			s.reset();
+		haveLast = false;
+		started = true;
+		sid = p->GetStreamId();
+		next = newest = fn;
+	}
+	else if (not isAhead(next, fn))
+	{
+		// before the next one to play, before playing that's fine, if it's not too far back
+		if (playing or ahead(fn, newest) >= max)
+		{
+			stats.late++;
+			return false;
+		}
+		next = fn;
+	}
+	else
+	{
+		// too far ahead? then make room
+		while (ahead(next, fn) >= max)
+			drop();
+	}
+
+	auto &s = slot(fn);
+	if (s)
+	{
+		stats.duplicates++;
+		return false;
+	}
+	if (p->IsLastPacket())
+		haveLast = true;
+	if (isAhead(newest, fn) or not isAhead(next, newest))
+		newest = fn;
+	s = std::move(p);
+
+	const auto d = Depth();
+	if (d > stats.maxDepth)
+		stats.maxDepth = d;
+	return true;
+}
+
+// throw away the next frame to play, or its place if it's missing
+void CJitterBuffer::drop()
+{
+	auto &s = slot(next);
+	if (s)
+	{
+		if (s->IsLastPacket())
+			haveLast = false;
+		s.reset();
+		stats.overflows++;
+	}
+	else
+		stats.lost++;
+	if (next == newest)
+		newest = (newest + 1u) & 0x7fffu;
+	next = (next + 1u) & 0x7fffu;
+}
+
+unsigned CJitterBuffer::Depth() const
+{
+	if (not started or not isAhead(next, newest))
+		return 0u;
+	return ahead(next, newest) + 1u;
+}
+
+bool CJitterBuffer::IsReady() const
+{
+	return started and (playing or haveLast or Depth() >= target);
+}
+
+std::unique_ptr<CPacket> CJitterBuffer::Pop(bool &concealed)
+{
+	concealed = false;
+	if (not started)
+		return nullptr;
+	playing = true;
+
+	// a lost frame with more than enough behind it is just skipped, that takes up some delay
+	while (not slot(next) and Depth() > target + 1u)
+	{
+		stats.lost++;
+		next = (next + 1u) & 0x7fffu;
+	}
+
+	auto &s = slot(next);
+	if (s)
+	{
+		// the frame itself goes out, only the 54 bytes a quiet frame needs are kept
+		memcpy(played.data(), s->GetCData(), played.size());
+		havePlayed = true;
+		next = (next + 1u) & 0x7fffu;
+		stats.frames++;
+		return std::move(s);
+	}
+
+	concealed = true;
+	if (0u == Depth())
+	{
+		// ran dry: fill in without giving up the frame's place, and buffer more from now on
+		stats.stretched++;
+		if (target < max)
+			target++;
+		return quiet(next);
+	}
+
+	// lost: later frames are in, so this one isn't coming
+	stats.lost++;
+	auto q = quiet(next);
+	next = (next + 1u) & 0x7fffu;
+	return q;
+}
+
+std::unique_ptr<CPacket> CJitterBuffer::quiet(uint16_t fn) const
+{
+	// before anything has been played, the LSD can come from any frame that is in
+	const uint8_t *from = havePlayed ? played.data() : nullptr;
+	for (uint16_t i=0; nullptr == from and i<JITTER_SLOTS; i++)
+		if (slots[i])
+			from = slots[i]->GetCData();
+
+	if (nullptr == from)
+		return nullptr;
+
+	auto q = std::make_unique<CPacket>();
+	q->Initialize(EPacketType::stream, from);
+	q->SetFrameNumber(fn & 0x7fffu);
+	// 3200 is all voice, 1600 is voice and then data, anything else gets nothing
+	memset(q->GetPayload(), 0, 16);
+	const auto pt = CFrameType(q->GetFrameType()).GetPayloadType();
+	if (EPayloadType::c2_3200 == pt or EPayloadType::c2_1600 == pt)
+		memcpy(q->GetPayload(), c2_quiet, 8);
+	if (EPayloadType::c2_3200 == pt)
+		memcpy(q->GetPayload() + 8, c2_quiet, 8);
+	q->CalcCRC();
+	return q;
+}
@@ -0,0 +1,83 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <memory>
+
+#include "Packet.h"
+
+#define JITTER_SLOTS 32		// a power of 2, so the slots wrap with the 15 bit frame number
+#define JITTER_MAX_DEPTH 25	// the most frames that can be configured, it has to be less than JITTER_SLOTS
+
+using SJitterStats = struct jitterstats_tag
+{
+	unsigned frames;		// real frames played
+	unsigned lost;			// frames that never came, played as quiet or skipped
+	unsigned late;			// frames that came after their time, they were dropped
+	unsigned stretched;		// quiet frames added when the buffer ran dry
+	unsigned overflows;		// frames dropped to keep the depth under the maximum
+	unsigned duplicates;
+	unsigned maxDepth;
+};
+
+// The jitter buffer between the gateway and the modulator. Stream frames go in with Push(),
+// in whatever order and at whatever time they arrive, and come out with Pop(), in frame number
+// order, one for every 40 ms frame the transmitter sends.
+// Playout starts once there are target frames. If the next frame is missing and later ones are
+// in, it was lost: it's played as quiet, or skipped if there are more than target frames to play.
+// If the buffer runs dry, quiet is played without giving up the frame's place, so a late frame
+// is still played, and the target grows by one, up to the maximum. A frame arriving more than
+// the maximum ahead of the next one to play pushes out the oldest, so the delay is bounded.
+// Quiet frames are the Codec2 quiet frame with the LSD of the last frame played.
+// It's not thread safe, only txProcess uses it.
+class CJitterBuffer
+{
+public:
+	// the depths are in frames, max is at most JITTER_MAX_DEPTH
+	void Configure(unsigned target, unsigned max);
+	// forget everything, for a new transmission
+	void Reset(void);
+
+	// returns false if the frame wasn't kept, because it was late or a duplicate
+	bool Push(std::unique_ptr<CPacket> &p);
+	// true if there are enough frames to start playing, or the last one is in
+	bool IsReady(void) const;
+	// the next frame, or a quiet one in its place, concealed is set if it's quiet,
+	// returns nullptr only if nothing has been pushed since the Reset()
+	std::unique_ptr<CPacket> Pop(bool &concealed);
+
+	// the frames from the next one to play to the newest one in, including the missing ones
+	unsigned Depth(void) const;
+	unsigned Target(void) const { return target; }
+	const SJitterStats &GetStats(void) const { return stats; }
+
+private:
+	std::unique_ptr<CPacket> &slot(uint16_t fn) { return slots[fn & (JITTER_SLOTS-1u)]; }
+	std::unique_ptr<CPacket> quiet(uint16_t fn) const;
+	void drop(void);
+
+	std::array<std::unique_ptr<CPacket>, JITTER_SLOTS> slots;
+	std::array<uint8_t, 54> played;	// the last frame played, quiet frames are made from its header and LSD
+	bool started = false, playing = false, haveLast = false, havePlayed = false;
+	uint16_t sid = 0, next = 0, newest = 0;
+	unsigned cfgTarget = 2, target = 2, max = 10;
+	SJitterStats stats {};
+};
@@ -35,20 +35,20 @@ struct SJsonKeys
 
 	struct MODEM
 	{
-		const std::string section, gpiochipDevice, uartDevice, uartBaudRate, boot0, nrst, rxFreq, txFreq, afc, freqCorr, txPower, debug;
+		const std::string section, gpiochipDevice, uartDevice, uartBaudRate, boot0, nrst, rxFreq, txFreq, afc, freqCorr, txPower, debug, rxReaderCore, rxDemodCore, captureFolder, captureFileSize, captureFiles, txJitterDepth, txJitterMaxDepth;
 	}
 	modem
 	{
-		"Modem", "GpioChipDevice", "UartDevice", "UartBaudRate", "BOOT0", "nRST", "RXFrequency", "TXFrequency", "AFC", "FreqCorrection", "TXPower", "Debug"
+		"Modem", "GpioChipDevice", "UartDevice", "UartBaudRate", "BOOT0", "nRST", "RXFrequency", "TXFrequency", "AFC", "FreqCorrection", "TXPower", "Debug", "RxReaderCore", "RxDemodCore", "CaptureFolder", "CaptureFileSize", "CaptureFiles", "TxJitterDepth", "TxJitterMaxDepth"
 	};
 
 	struct GATEWAY
 	{
-		const std::string section, ipv4, ipv6, startupLink, maintainLink, hostPath, myHostPath, dbPath, allowNotTranscoded, audioFolder;
+		const std::string section, ipv4, ipv6, startupLink, maintainLink, hostPath, myHostPath, dbPath, allowNotTranscoded, audioFolder, packetPoolSize;
 	}
 	gateway
 	{
-		"Gateway", "EnableIPv4", "EnableIPv6", "StartupLink", "MaintainLink", "HostPath", "MyHostPath", "DBPath", "AllowNotTranscoded", "AudioFolderPath"
+		"Gateway", "EnableIPv4", "EnableIPv6", "StartupLink", "MaintainLink", "HostPath", "MyHostPath", "DBPath", "AllowNotTranscoded", "AudioFolderPath", "PacketPoolSize"
 	};
 
 	struct DASHBOARD
@@ -0,0 +1,489 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <algorithm>
+
+#include "M17Demodulator.h"
+#include "Callsign.h"
+#include "CRC.h"
+
+extern CCRC g_Crc;
+
+#define SYNC_WINDOW 2
+// when tracking, the syncword is only searched for this many samples either side of where it's due
+
+static const int8_t lsf_sync_ext[16] { +3, -3, +3, -3, +3, -3, +3, -3, +3, +3, +3, +3, -3, -3, +3, -3 };
+static const float escale = 4.14647334e-6f; // 100%/0xffff/SYM_PER_PLD/2
+
+CM17Demodulator::CM17Demodulator()
+	: rx_filter(RX_SYMBOL_SCALING_COEFF)
+	, lsf_bits(syncBits(lsf_sync_ext,     16))
+	, str_bits(syncBits(str_sync_symbols,  8))
+	, pkt_bits(syncBits(pkt_sync_symbols,  8))
+	, eot_bits(syncBits(eot_symbols,       8))
+{
+}
+
+void CM17Demodulator::Process(const int8_t *block)
+{
+	// run the whole block through the RRC matched filter
+	rx_filter.Filter(f_block, block);
+	stats.samples += RX_BLOCK_LEN;
+	for (uint16_t ii=0; ii<RX_BLOCK_LEN; ii++)
+	{
+		// push the filtered sample on into the sample buffer
+		f_flt_buff.Push(f_block[ii]);
+		// the whole buffer as one contiguous array, oldest sample first
+		const rxsample_t *f = f_flt_buff.Data();
+
+		// shift the signs of the newest symbols into this phase's registers
+		sign_a[phase] = (sign_a[phase] << 1) | (f[75] < 0.0f);
+		sign_b[phase] = (sign_b[phase] << 1) | (f[960+75] < 0.0f);
+		const uint16_t sa = sign_a[phase];
+		const uint16_t sb = sign_b[phase];
+		if (5u == ++phase)
+			phase = 0u;
+
+		// once locked, the next syncword is only looked for near where it's due
+		if (tracking and (--track_cnt < -SYNC_WINDOW))
+		{
+			tracking = false; // not found in the window, back to acquisition
+			if (debug)
+				Log(EUnit::cc12, "RF sync lost, back to acquisition\n");
+		}
+
+		if (not tracking or track_cnt <= SYNC_WINDOW)
+		{
+			// First stage: count the hard decision errors against each syncword.
+			// Every symbol of every syncword is +/-3, so a sign error adds at least 9 to the SED,
+			// and no more than 2 sign errors can pass any of the thresholds below.
+			// Candidates that survive are decided by the full SED, just as before.
+			const unsigned eot_err = __builtin_popcount((sb >> 8) ^ eot_bits);
+			const unsigned lsf_err = __builtin_popcount(sa ^ lsf_bits);
+			const unsigned str_err = __builtin_popcount((sa >> 8) ^ str_bits) + std::min<unsigned>(__builtin_popcount((sb >> 8) ^ str_bits), eot_err);
+			const unsigned pkt_err = __builtin_popcount((sa >> 8) ^ pkt_bits) + std::min<unsigned>(__builtin_popcount((sb >> 8) ^ pkt_bits), eot_err);
+			stats.syncSearches++;
+
+			rxsed_t sed_lsf = RX_SED_MAX, sed_str = RX_SED_MAX, sed_pkt = RX_SED_MAX;
+			rxsample_t symbols[16];
+			if (lsf_err <= 2u or str_err <= 2u or pkt_err <= 2u)
+			{
+				stats.syncPasses++;
+				//L2 norm check against syncword
+				for (uint8_t i=0; i<16; i++)
+					symbols[i]=f[i*5];
+				sed_lsf = sed(symbols, lsf_sync_ext,    16);
+				rxsed_t sed_sma = sed(symbols, str_sync_symbols, 8);
+				rxsed_t sed_pma = sed(symbols, pkt_sync_symbols, 8);
+				for (uint8_t i=0; i<16; i++)
+					symbols[i]=f[960+i*5];
+				rxsed_t sed_eot = sed(symbols, eot_symbols,      8);
+				rxsed_t sed_smb = sed(symbols, str_sync_symbols, 8);
+				sed_str = sed_sma + ((sed_smb < sed_eot) ? sed_smb : sed_eot);
+				rxsed_t sed_pmb = sed(symbols, pkt_sync_symbols, 8);
+				sed_pkt = sed_pma + ((sed_pmb < sed_eot) ? sed_pmb : sed_eot);
+			}
+
+			//LSF received at idle state
+			if ((sed_lsf <= rxsed_t(22.25f * RX_SED_ONE)) and (rx_state == ERxState::idle))
+			{
+				//find minimum
+				uint8_t sample_offset = 0;
+				for (uint8_t i=1; i<=2; i++)
+				{
+					for (uint8_t j=0; j<16; j++)
+						symbols[j] = f[j*5+i];
+
+					rxsed_t d = sed(symbols, lsf_sync_ext, 16);
+
+					if (d < sed_lsf)
+					{
+						sed_lsf = d;
+						sample_offset = i;
+					}
+				}
+
+				float pld[SYM_PER_PLD];
+
+				for (uint16_t i=0; i<SYM_PER_PLD; i++)
+				{
+					pld[i]=float(f[16*5+i*5+sample_offset])/RX_SAMPLE_ONE; //add symbol timing correction
+				}
+
+				uint32_t e = viterbi.DecodeLSF((lsf_t*)(rxlsf.GetData()), pld);
+
+				if (not rxlsf.CheckCRC()) //if CRC valid
+				{
+					// the first frame sync is 960 samples past the LSF sync, which is 40 samples in
+					tracking = true;
+					track_cnt = 1000 + sample_offset;
+					stats.lsfFrames++;
+					if (not onLSF or onLSF(rxlsf))
+					{
+						got_lsf = true;
+						rxType.SetFrameType(rxlsf.GetFrameType());
+						rx_state = ((EPayloadType::packet == rxType.GetPayloadType()) ? ERxState::pkt : ERxState::str);
+						sample_cnt = 0;
+
+						const CCallsign dst(rxlsf.GetCDstAddress());
+						const CCallsign src(rxlsf.GetCSrcAddress());
+
+						Log(EUnit::cc12, "RF LSF DST: %s SRC: %s TYPE: %04X CAN: %d ED^2: %5.2f MER: %4.1f%%\n", dst.c_str(), src.c_str(), rxType.GetOriginType(), rxType.GetCan(), float(sed_lsf)/RX_SED_ONE, float(e)*escale);
+
+						if (EPayloadType::packet != rxType.GetPayloadType()) //if stream
+							fn = 0; // init values for stream mode
+					} else if (debug)
+						Log(EUnit::cc12, "RF LSF was not accepted\n");
+				}
+			}
+
+			//stream frame received
+			else if (sed_str <= rxsed_t(20.0f * RX_SED_ONE))
+			{
+				//find L2's minimum
+				uint8_t sample_offset=0;
+				for (uint8_t i=1; i<=2; i++)
+				{
+					for (uint8_t j=0; j<16; j++)
+						symbols[j]=f[j*5+i];
+					
+					rxsed_t tmp_a = sed(symbols, str_sync_symbols, 8);
+					// check the next frame, look for another data frame or EOT frame
+					for (uint8_t j=0; j<16; j++)
+						symbols[j] = f[960+j*5+i];
+					rxsed_t tmp_b = sed(symbols, str_sync_symbols, 8);
+					rxsed_t tmp_e = sed(symbols, eot_symbols,      8);
+					rxsed_t d = tmp_a + ((tmp_b < tmp_e) ? tmp_b : tmp_e);
+
+					if (d < sed_str)
+					{
+						sed_str = d;
+						sample_offset = i;
+					}
+				}
+
+				float pld[SYM_PER_PLD];
+				
+				for (uint16_t i=0; i<SYM_PER_PLD; i++)
+				{
+					pld[i]=float(f[40+i*5+sample_offset])/RX_SAMPLE_ONE;
+				}
+
+				uint8_t lich[6];
+				uint8_t lich_cnt;
+				uint8_t frame_data[16];
+				uint32_t e = viterbi.DecodeStream(frame_data, lich, &fn, &lich_cnt, pld);
+				stats.streamFrames++;
+				// the next frame sync is one frame (960 samples) past this one,
+				// after the last frame that's the EOT, so the lock is lost there
+				tracking = true;
+				track_cnt = 960 + sample_offset;
+				if (0 == lich_cnt)
+					lich_parts = 0;
+				uint16_t frame_count = fn & 0x7fffu;
+				if (first_frame) {
+					last_fn = frame_count - 1;
+					first_frame = false;
+				}
+				
+				if (((last_fn + 1u) & 0x7fffu) == frame_count)
+				{
+					if (got_lsf) // pass this data frame on
+					{
+						sample_cnt = 0;
+						if (onStream)
+							onStream(rxlsf, fn, frame_data);
+
+						if ((debug and (fn%12u==11u)) or (fn>>15))
+						{
+							Log(EUnit::cc12, "RF Stream Frame: FN:%04X ED^2:%5.2f MER:%4.1f%%\n", fn, float(sed_str)/RX_SED_ONE, float(e)*escale);
+						}
+					}
+
+					if (lich_parts != 0x3fu) // if the lich data is not complete
+					{
+						//reconstruct LSF chunk by chunk
+						memcpy(lsf_b+(5u*lich_cnt), lich, 5); //40 bits
+						lich_parts |= (1<<lich_cnt);
+						if (0x3fu == lich_parts) //collected all of them?
+						{
+							if (g_Crc.CheckCRC(lsf_b, 30)) {
+								if (debug)
+								{
+									Log(EUnit::cc12, "LICH LSF: CRC Error\n");
+									Dump(nullptr, lsf_b, 30);
+								}
+							} else {
+								memcpy(rxlsf.GetData(), lsf_b, 30);
+								if (not got_lsf)
+								{
+									rxType.SetFrameType(rxlsf.GetFrameType());
+									stats.lsfFrames++;
+									if (not onLSF or onLSF(rxlsf))
+									{
+										rx_state = ((EPayloadType::packet == rxType.GetPayloadType()) ? ERxState::pkt : ERxState::str); // the LICH
+										sample_cnt = 0; // LICH LSF
+										got_lsf = true;
+										const CCallsign dst(rxlsf.GetCDstAddress());
+										const CCallsign src(rxlsf.GetCSrcAddress());
+										Log(EUnit::cc12, "LICH LSF: DST: %s SRC: %s TYPE: %04X CAN: %d\n", dst.c_str(), src.c_str(), rxlsf.GetFrameType(), rxType.GetCan());
+									} else {
+										Log(EUnit::cc12, "Got LICH LSF, but it was not accepted\n");
+										Dump(nullptr, lsf_b, 30);
+									}
+								}
+							}
+							lich_parts = 0;
+						}
+					}
+					last_fn = fn;
+				}
+
+				if (fn >> 15) // is this the last frame?
+				{
+					// this is the last packet
+					rx_state = ERxState::idle; // last stream frame
+					got_lsf = false;
+					lich_parts = 0;
+					last_fn = 0xfffu;
+					first_frame = true;
+				}
+			}
+
+			//TODO: handle packet mode reception over RF
+			else if ((sed_pkt <= rxsed_t(25.0f * RX_SED_ONE)) and (rx_state == ERxState::pkt))
+			{
+				//find L2's minimum
+				uint8_t sample_offset = 0;
+				for (uint8_t i=1; i<=2; i++)
+				{
+					for (uint8_t j=0; j<8; j++)
+						symbols[j]=f[j*5+i];
+						
+					rxsed_t tmp_a = sed(symbols, pkt_sync_symbols, 8);
+					for (uint8_t j=0; j<16; j++)
+						symbols[j] = f[960+j*5+i];
+					rxsed_t tmp_b = sed(symbols, pkt_sync_symbols, 8);
+					rxsed_t tmp_c = sed(symbols, eot_symbols, 8);
+					rxsed_t d = tmp_a + ((tmp_c > tmp_b) ? tmp_b : tmp_c);
+
+					if (d < sed_pkt)
+					{
+						sed_pkt = d;
+						sample_offset = i;
+					}
+				}
+
+				float pld[SYM_PER_PLD];
+				for (uint16_t i=0; i<SYM_PER_PLD; i++)
+				{
+					pld[i]=float(f[8*5+i*5+sample_offset])/RX_SAMPLE_ONE;
+				}
+
+				if (ppkt == pkt_pld + sizeof(pkt_pld))
+				{
+					Log(EUnit::cc12, "RF PKT: Payload is too long, starting over\n");
+					ppkt = pkt_pld;
+					plsize = 0;
+				}
+				uint8_t eof, pkt_fn;
+				uint32_t e = viterbi.DecodePacket(ppkt, &eof, &pkt_fn, pld);
+				stats.packetFrames++;
+				sample_cnt = 0;
+				tracking = true;
+				track_cnt = 960 + sample_offset;
+
+				if (debug) Log(EUnit::cc12, "RF PacketFrame: EOF: %s FN: %u d^2:%5.2f MER: %4.1f\n", (eof ? "true " : "false"), unsigned(pkt_fn), float(sed_pkt)/RX_SED_ONE, e*escale);
+
+				// increment size and pointer
+				plsize += eof ? pkt_fn : 25;
+				ppkt += 25;
+
+				if(eof)
+				{
+					if (g_Crc.CheckCRC(pkt_pld, plsize))
+					{
+						Log(EUnit::cc12, "RF PKT: Payload CRC failed\n");
+						Dump(nullptr, pkt_pld, plsize);
+					} else {
+						if (got_lsf)
+						{
+							if (onPacket)
+								onPacket(rxlsf, pkt_pld, plsize);
+						} else {
+							Log(EUnit::cc12, "Got a Packet Payload, but not the LSF!");
+						}
+						if (debug) {
+							if (0x5u == *pkt_pld and 0u == pkt_pld[plsize-3]) {
+								Log(EUnit::cc12, "RF SMS Msg: %s", (char *)(pkt_pld+1));
+							} else {
+								Log(EUnit::cc12, "Packet Payload:\n");
+								Dump(nullptr, pkt_pld, plsize);
+							}
+						}
+					}
+					// ready for the next packet
+					ppkt = pkt_pld;
+					plsize = 0;
+				}
+			}
+		}
+
+		//RX sync timeout
+		if (rx_state != ERxState::idle)
+		{
+			sample_cnt++;
+			if (960*2 <= sample_cnt) // 80 ms without detecting anything in the sync'ed state
+				timeout();
+		}
+	}
+}
+
+void CM17Demodulator::timeout()
+{
+	Log(EUnit::cc12, "RF Timeout\n");
+	stats.timeouts++;
+	rx_state = ERxState::idle; // timeout
+	tracking = false;
+	if (onTimeout)
+		onTimeout();
+	if (debug)
+		Log(EUnit::cc12, "Sync pre-detector: %llu of %llu searches passed to the SED check\n", (unsigned long long)stats.syncPasses, (unsigned long long)stats.syncSearches);
+	got_lsf = false;
+	sample_cnt = 0;
+	// stream mode reset
+	lich_parts = 0;
+	last_fn = 0xffffu;
+	// packet mode reset
+	ppkt = pkt_pld;
+	plsize = 0;
+}
+
+/**
+ * @brief Pack the hard decisions of a syncword into a word, the first symbol in the most significant bit.
+ *
+ * @param v Syncword symbols.
+ * @param n Number of symbols, no more than 16.
+ * @return uint16_t A 1 for every negative symbol.
+ */
+uint16_t CM17Demodulator::syncBits(const int8_t *v, const unsigned n) const
+{
+	uint16_t r = 0;
+	for (unsigned i=0; i<n; i++)
+		r = (r << 1) | (v[i] < 0);
+	return r;
+}
+
+/**
+ * @brief Calculate squared Euclidean distance between two n-dimensional vectors.
+ * It is the sum of squared differences.
+ *
+ * @param v1 Vector 1 - filtered samples.
+ * @param v2 Vector 2 - signed ints, in symbol units.
+ * @param n Vectors' size.
+ * @return rxsed_t Squared distance between two points.
+ */
+rxsed_t CM17Demodulator::sed(const rxsample_t *v1, const int8_t *v2, const unsigned n) const
+{
+	rxsed_t r = 0;
+	for (unsigned i=0; i<n; i++)
+	{
+		auto x = rxsed_t(v1[i]) - rxsed_t(v2[i]) * RX_SAMPLE_ONE;
+		r += x * x;
+	}
+	return r;
+}
+
+#ifdef M17REPLAY
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+#include "Capture.h"
+
+CCRC g_Crc;
+
+static void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-d] BasebandFile [BasebandFile ...]\n", name);
+	fprintf(stderr, "Each file is either an mspot capture file, or raw, signed 8-bit baseband samples at 24 kS/s.\n");
+	fprintf(stderr, "-d turns on the demodulator's debugging log\n");
+}
+
+// Run recorded baseband through the demodulator as fast as it will go,
+// then report how fast that was and what was decoded.
+int main(int argc, char *argv[])
+{
+	bool debug = false;
+	int first = 1;
+	if (argc > 1 and 0 == strcmp(argv[1], "-d"))
+	{
+		debug = true;
+		first++;
+	}
+	if (first >= argc)
+	{
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t streams = 0, streamFrames = 0, packets = 0, packetBytes = 0;
+	CM17Demodulator demod;
+	demod.SetDebug(debug);
+	demod.SetLSFCallback([&](const SLSF &) { streams++; return true; });
+	demod.SetStreamCallback([&](const SLSF &, uint16_t, const uint8_t *) { streamFrames++; });
+	demod.SetPacketCallback([&](const SLSF &, const uint8_t *, uint16_t size) { packets++; packetBytes += size; });
+
+	double seconds = 0.0;
+	unsigned gaps = 0;
+	CCaptureReader reader;
+	SCaptureRecord rec;
+	for (int a=first; a<argc; a++)
+	{
+		if (reader.Open(argv[a]))
+			return EXIT_FAILURE;
+		// only the demodulator is timed, not the file reads
+		uint64_t last_ns = 0;
+		while (reader.Read(rec))
+		{
+			// blocks arrive every 40 ms, so a wait of more than 100 ms means some were lost
+			if (last_ns and rec.ns - last_ns > 100000000u)
+				gaps++;
+			last_ns = rec.ns;
+			const auto start = std::chrono::steady_clock::now();
+			demod.Process(rec.samples);
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		reader.Close();
+	}
+
+	const auto &s = demod.GetStats();
+	printf("%llu samples (%.1f s of baseband) demodulated in %.3f s\n", (unsigned long long)s.samples, s.samples / 24000.0, seconds);
+	if (seconds > 0.0)
+		printf("%.0f samples/s, %.1f times real time\n", s.samples / seconds, s.samples / 24000.0 / seconds);
+	printf("Frames decoded: %llu LSF, %llu stream, %llu packet\n", (unsigned long long)s.lsfFrames, (unsigned long long)s.streamFrames, (unsigned long long)s.packetFrames);
+	printf("Passed on: %llu transmissions, %llu stream frames, %llu packets (%llu bytes), %llu timeouts\n", (unsigned long long)streams, (unsigned long long)streamFrames, (unsigned long long)packets, (unsigned long long)packetBytes, (unsigned long long)s.timeouts);
+	printf("Sync pre-detector: %llu of %llu searches passed to the SED check\n", (unsigned long long)s.syncPasses, (unsigned long long)s.syncSearches);
+	if (gaps)
+		printf("There were %u gaps in the capture\n", gaps);
+	return EXIT_SUCCESS;
+}
+
+#endif
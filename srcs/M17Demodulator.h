@@ -0,0 +1,120 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "RingBuffer.h"
+#include "RxFilter.h"
+#include "Viterbi.h"
+#include "FrameType.h"
+#include "Base.h"
+#include "LSF.h"
+
+#define RX_SYMBOL_SCALING_COEFF	(1.0f/(0.8f/(40.0e3f/2097152*0xAD)*130.0f))
+// CC1200 User's Guide, p. 24
+// 0xAD is `DEVIATION_M`, 2097152=2^21
+// +1.0 is the symbol for +0.8kHz
+// 40.0e3 is F_TCXO in kHz
+// 129 is `CFM_RX_DATA_OUT` register value at max. F_DEV (130 is 1 off but offers a better symbol map)
+// datasheet might have this wrong (it says 64)
+
+enum class ERxState { idle, str, pkt };
+
+using SRxStats = struct rxstats_tag
+{
+	uint64_t samples, lsfFrames, streamFrames, packetFrames, timeouts;
+	uint64_t syncSearches, syncPasses;
+};
+
+// The M17 demodulator: it's fed blocks of RX_BLOCK_LEN raw baseband samples, just as they come
+// from the CC1200, and it reports what it decodes through the callbacks. It knows nothing about
+// the modem, the gateway or the gate state, so it can be driven by a recording just as well.
+// All of the callbacks are made from the thread that calls Process().
+class CM17Demodulator : public CBase
+{
+public:
+	// a link setup frame arrived, from the RF LSF or reassembled from the LICH,
+	// return true to accept the transmission, false to ignore it
+	using LSFCallback = std::function<bool(const SLSF &lsf)>;
+	// a stream frame of an accepted transmission, payload is 16 bytes
+	using StreamCallback = std::function<void(const SLSF &lsf, uint16_t fn, const uint8_t *payload)>;
+	// a complete packet with a good CRC of an accepted transmission
+	using PacketCallback = std::function<void(const SLSF &lsf, const uint8_t *payload, uint16_t size)>;
+	// the transmission stopped without an EOT
+	using TimeoutCallback = std::function<void(void)>;
+
+	CM17Demodulator();
+
+	void SetLSFCallback(LSFCallback cb)         { onLSF     = std::move(cb); }
+	void SetStreamCallback(StreamCallback cb)   { onStream  = std::move(cb); }
+	void SetPacketCallback(PacketCallback cb)   { onPacket  = std::move(cb); }
+	void SetTimeoutCallback(TimeoutCallback cb) { onTimeout = std::move(cb); }
+	void SetDebug(bool dbg) { debug = dbg; }
+
+	// demodulate one block of RX_BLOCK_LEN baseband samples
+	void Process(const int8_t *block);
+
+	const SRxStats &GetStats(void) const { return stats; }
+
+private:
+	void timeout(void);
+	rxsed_t sed(const rxsample_t *v1, const int8_t *v2, const unsigned len) const;
+	uint16_t syncBits(const int8_t *v, const unsigned n) const;
+
+	LSFCallback onLSF;
+	StreamCallback onStream;
+	PacketCallback onPacket;
+	TimeoutCallback onTimeout;
+	bool debug = false;
+	SRxStats stats {};
+
+	CRxFilter<rxsample_t> rx_filter;
+	CViterbi viterbi;
+	rxsample_t f_block[RX_BLOCK_LEN];
+	RingBuffer<rxsample_t, 2042> f_flt_buff;
+	// why 2042? 8*5+2*(8*5+4800/25*5)+2 = 2042
+	// 8 preamble symbols, 8 for the syncword, and 960 for the payload.
+	// floor(sps/2)=2 extra samples for timing error correction
+
+	bool got_lsf = false;
+	uint8_t lsf_b[30];
+	bool first_frame = true;
+	uint16_t fn = 0;
+	uint16_t last_fn = 0xffffu;
+	uint16_t sample_cnt = 0;
+	SLSF rxlsf;
+	CFrameType rxType;
+	ERxState rx_state = ERxState::idle;
+	// sync tracking: once a frame is decoded, track_cnt counts down to where the next syncword is due
+	bool tracking = false;
+	int track_cnt = 0;
+	// sync pre-detector: the hard decisions of every 5th sample, one register for each sample phase,
+	// for the 16 symbols at the start of the buffer (a) and the 16 symbols one frame later (b)
+	uint16_t sign_a[5] { 0 }, sign_b[5] { 0 };
+	unsigned phase = 0;
+	const uint16_t lsf_bits, str_bits, pkt_bits, eot_bits;
+	// for stream mode
+	uint8_t lich_parts = 0;
+	// for packet mode
+	uint8_t pkt_pld[825];
+	uint8_t *ppkt = pkt_pld;
+	uint16_t plsize = 0;
+};
@@ -0,0 +1,409 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <cmath>
+
+#include "M17Modulator.h"
+
+void CM17Modulator::Reset()
+{
+	memset(sr, 0, sizeof(sr));
+	w = 0;
+	codes = 0;
+	primed = 0;
+	after_preamble = false;
+}
+
+void CM17Modulator::Prepare()
+{
+	if (cached)
+		return;
+
+	// the preamble, from a flushed filter
+	int8_t sym[SYM_PER_FRA];
+	uint32_t cnt = 0;
+	gen_preamble_i8(sym, &cnt, PREAM_LSF);
+	Reset();
+	filter(preamble_bsb, sym, SYM_PER_FRA);
+	memcpy(preamble_last, sym + SYM_PER_FRA - (TX_TAPS_PER_PHASE-1), TX_TAPS_PER_PHASE-1);
+
+	// the EOT, only the samples after the first 8 symbols will be used
+	cnt = 0;
+	gen_eot_i8(eot_symbols, &cnt);
+	filter(eot_bsb, eot_symbols, SYM_PER_FRA);
+
+	Reset();
+	cached = true;
+}
+
+void CM17Modulator::Preamble(int8_t *out)
+{
+	Prepare();
+	memcpy(out, preamble_bsb, TX_BLOCK_LEN);
+	restore(preamble_last);
+	after_preamble = true;
+}
+
+void CM17Modulator::LSF(int8_t *out, const SLSF &lsf)
+{
+	if (after_preamble)
+	{
+		for (auto &c : lsf_cache)
+		{
+			if (c.valid and 0 == memcmp(c.lsf, lsf.GetCData(), 30))
+			{
+				memcpy(out, c.bsb, TX_BLOCK_LEN);
+				restore(c.last);
+				return;
+			}
+		}
+	}
+
+	const bool cacheable = after_preamble;
+	gen_frame_i8(symbols, nullptr, FRAME_LSF, (const lsf_t *)(lsf.GetCData()), 0, 0);
+	Filter(out, symbols);
+
+	if (cacheable)
+	{
+		// replace the oldest one
+		auto &c = lsf_cache[lsf_next];
+		lsf_next = (lsf_next + 1u) % TX_LSF_CACHE_SIZE;
+		memcpy(c.lsf, lsf.GetCData(), 30);
+		memcpy(c.last, symbols + SYM_PER_FRA - (TX_TAPS_PER_PHASE-1), TX_TAPS_PER_PHASE-1);
+		memcpy(c.bsb, out, TX_BLOCK_LEN);
+		c.valid = true;
+	}
+}
+
+void CM17Modulator::StreamFrame(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint8_t lich_cnt, uint16_t fn)
+{
+	gen_frame_i8(symbols, payload, FRAME_STR, (const lsf_t *)(lsf.GetCData()), lich_cnt, fn);
+	Filter(out, symbols);
+}
+
+void CM17Modulator::PacketFrame(int8_t *out, const uint8_t *pld)
+{
+	gen_frame_i8(symbols, pld, FRAME_PKT, nullptr, 0, 0);
+	Filter(out, symbols);
+}
+
+void CM17Modulator::EOT(int8_t *out)
+{
+	Prepare();
+	// the first 8 symbols reach back into the last frame, after that it's always the same
+	filter(out, eot_symbols, TX_TAPS_PER_PHASE-1);
+	memcpy(out + 5*(TX_TAPS_PER_PHASE-1), eot_bsb + 5*(TX_TAPS_PER_PHASE-1), TX_BLOCK_LEN - 5*(TX_TAPS_PER_PHASE-1));
+	restore(eot_symbols + SYM_PER_FRA - (TX_TAPS_PER_PHASE-1));
+}
+
+unsigned CM17Modulator::StreamStart(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint16_t fn)
+{
+	fn &= 0x7fffu;
+	Preamble(out);
+	LSF(out + TX_BLOCK_LEN, lsf);
+	StreamFrame(out + 2 * TX_BLOCK_LEN, lsf, payload, fn % 6u, fn);
+	return 3;
+}
+
+unsigned CM17Modulator::Stream(int8_t *out, const SLSF &lsf, const uint8_t *payloads, unsigned count, uint16_t fn, bool last)
+{
+	unsigned n = 0;
+	for (unsigned i=0; i<count; i++)
+	{
+		const uint16_t f = (fn + i) & 0x7fffu;
+		StreamFrame(out + n++ * TX_BLOCK_LEN, lsf, payloads + 16u * i, f % 6u, (last and i+1 == count) ? (f | 0x8000u) : f);
+	}
+	if (last)
+		EOT(out + n++ * TX_BLOCK_LEN);
+	return n;
+}
+
+unsigned CM17Modulator::Packet(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint16_t size)
+{
+	Preamble(out);
+	unsigned n = 1 + PacketData(out + TX_BLOCK_LEN, lsf, payload, size);
+	EOT(out + n++ * TX_BLOCK_LEN);
+	return n;
+}
+
+unsigned CM17Modulator::PacketData(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint16_t size)
+{
+	LSF(out, lsf);
+	unsigned n = 1;
+
+	uint8_t pld[26];
+	uint8_t frame = 0;
+	while (size > 25)
+	{
+		memcpy(pld, payload + frame * 25, 25);
+		pld[25] = frame << 2;
+		PacketFrame(out + n++ * TX_BLOCK_LEN, pld);
+		size -= 25;
+		frame++;
+	}
+	memset(pld, 0, 26);
+	memcpy(pld, payload + frame * 25, size);
+	pld[25] = (1 << 7) | (size << 2); //EoT flag set, amount of remaining data in the 'frame number' field
+	PacketFrame(out + n++ * TX_BLOCK_LEN, pld);
+	return n;
+}
+
+static const float gain = TX_SYMBOL_SCALING_COEFF*sqrtf(5.0f);
+
+// An output sample within this distance of an integer is done in float. Each table entry and add
+// is off by at most half a float ulp, and so is each step of the float filter, which all adds up
+// to less than 2e-4 at the largest possible output, so this is conservative.
+#define TX_LUT_MARGIN 1.0e-3f
+
+// lut[g][i][ph] is the scaled sum, for phase ph, of the 3 symbols in group g coded as i
+using STxLUT = struct txlut_tag
+{
+	float v[3][64][8];
+};
+
+static const STxLUT makeLUT()
+{
+	STxLUT t {};
+	static const double sym[4] { -3.0, -1.0, 1.0, 3.0 };
+	for (unsigned g=0; g<3; g++)
+	{
+		for (unsigned i=0; i<64; i++)
+		{
+			for (unsigned ph=0; ph<5; ph++)
+			{
+				double sum = 0.0;
+				for (unsigned m=0; m<3; m++)
+					sum += sym[(i >> (2*m)) & 0x3u] * double(rrc_taps_5_poly[ph*TX_TAPS_PER_PHASE + 3*g + m]);
+				t.v[g][i][ph] = float(sum * double(gain));
+			}
+		}
+	}
+	return t;
+}
+
+static const STxLUT tx_lut = makeLUT();
+
+// the float RRC filter for one output sample, hp[0] is the newest symbol
+int8_t CM17Modulator::filterPhase(const float *__restrict hp, uint8_t ph) const
+{
+	const float * __restrict tp = rrc_taps_5_poly + ph*TX_TAPS_PER_PHASE;
+	float acc;
+
+	//fully unrolled 9-tap dot product
+	acc  = hp[0] * tp[0];
+	acc += hp[1] * tp[1];
+	acc += hp[2] * tp[2];
+	acc += hp[3] * tp[3];
+	acc += hp[4] * tp[4];
+	acc += hp[5] * tp[5];
+	acc += hp[6] * tp[6];
+	acc += hp[7] * tp[7];
+	acc += hp[8] * tp[8];
+
+	return (int8_t)(int32_t)(acc * gain);
+}
+
+// put a symbol into the filter history, returns the window, hp[0] is this symbol
+const float *CM17Modulator::push(int8_t s)
+{
+	//store once, duplicated for linear access
+	float * __restrict hp = &sr[w];
+	hp[0]				  = (float)s;
+	hp[TX_TAPS_PER_PHASE] = (float)s;
+
+	//and the 2 bit code for the tables, only the 4 symbols have one
+	codes = ((codes << 2) | (uint32_t(s + 3) >> 1)) & 0x3ffffu;
+	if (s == -3 or s == -1 or s == 1 or s == 3)
+	{
+		if (primed < TX_TAPS_PER_PHASE)
+			primed++;
+	}
+	else
+		primed = 0;
+
+	//circular index update without modulo
+	if (w == 0)
+		w = TX_TAPS_PER_PHASE-1;
+	else
+		w--;
+
+	return hp;
+}
+
+// after a cached frame, make the filter history what it would have been, last is the frame's last 8 symbols
+void CM17Modulator::restore(const int8_t *last)
+{
+	Reset();
+	for (unsigned i=0; i<TX_TAPS_PER_PHASE-1; i++)
+		push(last[i]);
+}
+
+void CM17Modulator::Filter(int8_t *out, const int8_t *in)
+{
+	filter(out, in, SYM_PER_FRA);
+}
+
+// the RRC pulse shaping filter, 5 samples out for every symbol in
+void CM17Modulator::filter(int8_t *__restrict out, const int8_t *__restrict in, unsigned n)
+{
+	after_preamble = false;
+	for (unsigned i = 0; i < n; i++)
+	{
+		//insert new sample per symbol
+		const float *hp = push(in[i]);
+
+		if (useLUT and TX_TAPS_PER_PHASE == primed)
+		{
+			const float *a = tx_lut.v[0][codes & 0x3fu];
+			const float *b = tx_lut.v[1][(codes >> 6) & 0x3fu];
+			const float *c = tx_lut.v[2][(codes >> 12) & 0x3fu];
+			for (uint8_t ph = 0; ph < 5; ph++)
+			{
+				const float y = a[ph] + b[ph] + c[ph];
+				const int32_t n = (int32_t)y;
+				const float f = fabsf(y - (float)n);
+				if (f > TX_LUT_MARGIN and f < 1.0f - TX_LUT_MARGIN)
+					out[i*5 + ph] = (int8_t)n;
+				else
+					out[i*5 + ph] = filterPhase(hp, ph);	// too close to call
+			}
+		}
+		else
+		{
+			//generate sps (5) output samples
+			for (uint8_t ph = 0; ph < 5; ph++)
+				out[i*5 + ph] = filterPhase(hp, ph);
+		}
+	}
+}
+
+#ifdef MODULATOR_BENCH
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <random>
+
+#include "CRC.h"
+
+CCRC g_Crc;
+
+// a de Bruijn sequence of order 9 over the 4 symbols contains every possible 9 symbol window
+static void deBruijn(std::vector<int8_t> &seq, std::vector<int8_t> &a, unsigned t, unsigned p)
+{
+	static const int8_t sym[4] { -3, -1, 1, 3 };
+	if (t > TX_TAPS_PER_PHASE)
+	{
+		if (0 == TX_TAPS_PER_PHASE % p)
+			for (unsigned j=1; j<=p; j++)
+				seq.push_back(sym[a[j]]);
+		return;
+	}
+	a[t] = a[t-p];
+	deBruijn(seq, a, t+1, p);
+	for (int8_t j=a[t-p]+1; j<4; j++)
+	{
+		a[t] = j;
+		deBruijn(seq, a, t+1, t);
+	}
+}
+
+// Check that the table driven filter matches the float filter for every symbol window
+// and for real frames, then compare their speed.
+int main(int argc, char *argv[])
+{
+	const unsigned count = (argc > 1) ? unsigned(atoi(argv[1])) : 20000u;
+	if (0u == count)
+	{
+		fprintf(stderr, "Usage: %s [NumberOfFrames]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// every window, wrapped around so the last windows are complete, and padded to whole frames
+	std::vector<int8_t> seq, a(TX_TAPS_PER_PHASE+1, 0);
+	deBruijn(seq, a, 1, 1);
+	const size_t windows = seq.size();
+	for (unsigned i=0; i<TX_TAPS_PER_PHASE-1; i++)
+		seq.push_back(seq[i]);
+	while (seq.size() % SYM_PER_FRA)
+		seq.push_back(3);
+
+	CM17Modulator lut, flt(false);
+	std::vector<int8_t> out[2];
+	out[0].resize(seq.size() * 5);
+	out[1].resize(seq.size() * 5);
+	for (size_t i=0; i<seq.size(); i+=SYM_PER_FRA)
+	{
+		lut.Filter(out[0].data() + 5*i, seq.data() + i);
+		flt.Filter(out[1].data() + 5*i, seq.data() + i);
+	}
+	size_t mismatches = 0;
+	for (size_t i=0; i<out[0].size(); i++)
+		if (out[0][i] != out[1][i])
+			mismatches++;
+	if (mismatches)
+	{
+		printf("ERROR: the filters disagree on %zu of %zu samples of the symbol windows\n", mismatches, out[0].size());
+		return EXIT_FAILURE;
+	}
+	printf("Both filters produce the same samples for all %zu symbol windows\n", windows);
+
+	// some real transmissions: packets of random data, and random stream frames
+	std::mt19937 rng(17);
+	SLSF lsf;
+	for (unsigned i=0; i<30; i++)
+		lsf.GetData()[i] = uint8_t(rng());
+	std::vector<uint8_t> data(16 * 120);
+	for (auto &b : data)
+		b = uint8_t(rng());
+	static int8_t bsb[2][TX_MAX_PACKET_FRAMES * TX_BLOCK_LEN];
+	for (unsigned size=1; size<=825; size+=37)
+	{
+		const auto n = lut.Packet(bsb[0], lsf, data.data(), size);
+		flt.Packet(bsb[1], lsf, data.data(), size);
+		if (memcmp(bsb[0], bsb[1], n * TX_BLOCK_LEN))
+		{
+			printf("ERROR: the filters disagree on a %u byte packet\n", size);
+			return EXIT_FAILURE;
+		}
+	}
+	printf("Both filters produce the same packet transmissions\n");
+
+	// then time them
+	double seconds[2];
+	CM17Modulator *mod[2] { &flt, &lut };
+	for (unsigned which=0; which<2; which++)
+	{
+		unsigned sum = 0;
+		mod[which]->StreamStart(bsb[which], lsf, data.data());
+		const auto start = std::chrono::steady_clock::now();
+		for (unsigned n=0; n<count; n++)
+		{
+			mod[which]->Filter(bsb[which], seq.data() + (n % 1000u) * SYM_PER_FRA);
+			sum += uint8_t(bsb[which][n % TX_BLOCK_LEN]);
+		}
+		seconds[which] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%s %u frames in %.3f s, %.0f frames/s (sample sum %u)\n", which ? "table:" : "float:", count, seconds[which], count / seconds[which], sum);
+	}
+	printf("The table driven filter is %.2f times as fast as the float filter\n", seconds[0] / seconds[1]);
+	return EXIT_SUCCESS;
+}
+
+#endif
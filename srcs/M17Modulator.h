@@ -0,0 +1,120 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+//libm17
+#include <m17.h>
+
+#include "LSF.h"
+
+#define TX_SYMBOL_SCALING_COEFF	(0.8f/((40.0e3f/2097152)*0xAD)*64.0f)
+// 0xAD is `DEVIATION_M`, 2097152=2^21
+// +0.8kHz is the deviation for symbol +1
+// 40.0e3 is F_TCXO in kHz
+// 64 is `CFM_TX_DATA_IN` register value for max. F_DEV
+
+#define TX_BLOCK_LEN 960			// the number of baseband samples in each CMD_TX_DATA frame, SYM_PER_FRA*5
+#define TX_TAPS_PER_PHASE 9			// taps in each of the 5 phases of the RRC polyphase filter
+#define TX_MAX_PACKET_FRAMES 36		// preamble, LSF, 33 packet frames and EOT
+#define TX_LSF_CACHE_SIZE 8			// the number of modulated LSFs kept for reuse
+
+// The M17 modulator: it makes the symbols of each frame with libm17 and runs them through
+// the RRC pulse shaping filter, giving TX_BLOCK_LEN baseband samples per frame for the CC1200.
+// The filter history belongs to the object, so any number of modulators can be used at once.
+// Normally the filter is table driven: every symbol is one of -3, -1, +1 or +3, so each
+// group of 3 symbols in the 9 symbol window has only 64 possible (scaled) partial sums per phase,
+// and each output sample is just 3 lookups and 2 adds. When a sum lands so close to an integer
+// that it might truncate differently than the float filter would, that one sample is done in float,
+// so the output is always identical to the float filter's.
+// Besides the single frame functions, a whole superframe, or a whole packet transmission,
+// can be modulated in one call, so it can all be done before any of it has to be sent.
+// The preamble always starts from a flushed filter, so it's only modulated once. Since the LSF
+// always follows the preamble, the last few LSFs are kept, and a repeated one is just copied.
+// Only the first 8 symbols of the EOT depend on what came before it, so only those are filtered.
+// All of the out buffers must hold TX_BLOCK_LEN samples for each frame.
+class CM17Modulator
+{
+public:
+	// lut = false uses only the float filter, the reference for the table driven one
+	CM17Modulator(bool lut = true) : useLUT(lut) {}
+
+	// flush the filter
+	void Reset(void);
+	// modulate the cached preamble and EOT now, instead of at the first transmission
+	void Prepare(void);
+
+	// these each modulate one frame, the preamble always starts a new transmission
+	void Preamble(int8_t *out);
+	void LSF(int8_t *out, const SLSF &lsf);
+	void StreamFrame(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint8_t lich_cnt, uint16_t fn);
+	// pld is 25 bytes of data and the EOF/frame number byte
+	void PacketFrame(int8_t *out, const uint8_t *pld);
+	void EOT(int8_t *out);
+
+	// The start of a stream, the preamble, the LSF and the first frame, this always returns 3.
+	// A stream can start anywhere in a superframe, the first frame's LICH counter is fn % 6.
+	unsigned StreamStart(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint16_t fn = 0);
+	// count stream frames, the payloads are each 16 bytes, one after the other, and fn is the frame number
+	// of the first one. If last is true, the last frame is marked as such and the EOT is added.
+	// Returns the number of frames in out.
+	unsigned Stream(int8_t *out, const SLSF &lsf, const uint8_t *payloads, unsigned count, uint16_t fn, bool last);
+	// A whole packet transmission, from the preamble to the EOT, out must have room for PacketFrames(size) frames.
+	// Returns the number of frames in out.
+	unsigned Packet(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint16_t size);
+	// Just the LSF and the packet frames, so more than one packet can go out in a transmission:
+	// the first after a Preamble(), each one after that right behind the last, then the EOT.
+	// Returns the number of frames in out, PacketFrames(size)-2 at most.
+	unsigned PacketData(int8_t *out, const SLSF &lsf, const uint8_t *payload, uint16_t size);
+	static unsigned PacketFrames(uint16_t size) { return 3u + ((size > 25u) ? (size + 24u) / 25u : 1u); }
+
+	// pulse shape SYM_PER_FRA symbols into TX_BLOCK_LEN samples
+	void Filter(int8_t *out, const int8_t *in);
+
+private:
+	void filter(int8_t *out, const int8_t *in, unsigned n);
+	const float *push(int8_t s);
+	void restore(const int8_t *last);
+	int8_t filterPhase(const float *hp, uint8_t ph) const;
+
+	const bool useLUT;
+	int8_t symbols[SYM_PER_FRA];
+	// the filter history, duplicated so each phase is a linear dot product
+	float sr[TX_TAPS_PER_PHASE * 2] { 0 };
+	uint8_t w = 0;
+	// the same history for the tables, 2 bits per symbol, the newest in the low bits
+	uint32_t codes = 0;
+	// how many of the symbols in the window are real, the tables can't be used until all 9 are
+	unsigned primed = 0;
+
+	// the caches, each with the last symbols of the frame, to put the filter history back
+	using SLSFCache = struct lsfcache_tag
+	{
+		bool valid;
+		uint8_t lsf[30];
+		int8_t last[TX_TAPS_PER_PHASE-1];
+		int8_t bsb[TX_BLOCK_LEN];
+	};
+	bool cached = false, after_preamble = false;
+	int8_t preamble_last[TX_TAPS_PER_PHASE-1], preamble_bsb[TX_BLOCK_LEN];
+	int8_t eot_symbols[SYM_PER_FRA], eot_bsb[TX_BLOCK_LEN];
+	SLSFCache lsf_cache[TX_LSF_CACHE_SIZE] {};
+	unsigned lsf_next = 0;
+};
@@ -21,6 +21,7 @@
 #include <csignal>
 #include <filesystem>
 #include <thread>
+#include <future>
 #include <chrono>
 
 #include <pwd.h>
@@ -28,6 +29,8 @@
 #include "Configure.h"
 #include "Version.h"
 #include "Gateway.h"
+#include "PacketPool.h"
+#include "EventLoop.h"
 #include "CC1200.h"
 #include "CRC.h"
 
@@ -37,6 +40,8 @@ CConfigure g_Cfg;
 CCRC       g_Crc;
 CGateway   g_Gateway;
 CCC1200    g_Modem;
+extern CEventLoop g_EventLoop;
+extern CPacketPool g_PacketPool;
 
 static int  caught_signal = 0;
 
@@ -56,6 +61,7 @@ int main(int argc, char** argv)
 	std::signal(SIGINT,  sigHandler);
 	std::signal(SIGTERM, sigHandler);
 	std::signal(SIGHUP,  sigHandler);
+	std::signal(SIGUSR1, sigHandler);
 	if (argc != 2)
 	{
 		usage(argv[0]);
@@ -84,23 +90,69 @@ int main(int argc, char** argv)
 	printf("%s-%s is starting  \n\n", pp.filename().c_str(), g_Version.c_str());
 
 	g_Gateway.SetName(pp.filename());
+
+	// all of the packets are made now, it's not changed by a SIGHUP
+	const auto poolSize = g_Cfg.GetUnsigned(g_Keys.gateway.section, g_Keys.gateway.packetPoolSize);
+	if (g_PacketPool.Reserve(poolSize))
+	{
+		printf("Could not make a pool of %u packets\n", poolSize);
+		return EXIT_FAILURE;
+	}
+	printf("Packet pool has %u packets, %u kB\n", poolSize, unsigned(poolSize * sizeof(CPacket) / 1024u));
 	
 	do
 	{
 		caught_signal = 0;
+		const auto start = std::chrono::steady_clock::now();
+
+		// the UART, the sockets and the gateway's timers are all served by the event loop
+		if (g_EventLoop.Start(g_Cfg.GetInt(g_Keys.modem.section, g_Keys.modem.rxReaderCore)))
+			return EXIT_FAILURE;
 
-		if (g_Modem.Start())
+		// the gateway gets ready while the modem is coming out of reset
+		auto gatePrep = std::async(std::launch::async, &CGateway::Prepare, &g_Gateway);
+		const bool modemFailed = g_Modem.Start();
+		const bool gateFailed = gatePrep.get();
+		if (gateFailed or modemFailed)
+		{
+			// release whichever one did start
+			if (not gateFailed)
+				g_Gateway.Stop();
+			if (not modemFailed)
+				g_Modem.Stop();
+			g_EventLoop.Stop();
 			return EXIT_FAILURE;
+		}
 		if (g_Gateway.Start())
 		{
+			g_Gateway.Stop();
 			g_Modem.Stop();
+			g_EventLoop.Stop();
 			return EXIT_FAILURE;
 		}
+		printf("%s is ready, start-up took %u ms\n", pp.filename().c_str(), unsigned(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
 		
-		pause();	// wait for a signal
+		// SIGUSR1 retunes the radio from the ini file, without a restart
+		do
+		{
+			caught_signal = 0;
+			pause();	// wait for a signal
+			if (SIGUSR1 == caught_signal)
+			{
+				CConfigure newcfg;
+				if (newcfg.ReadData(arg))
+					printf("There is a problem with %s, the radio settings were not changed\n", arg.c_str());
+				else
+					g_Modem.Retune(newcfg);
+			}
+		} while (SIGUSR1 == caught_signal);
 
 		g_Gateway.Stop();
 		g_Modem.Stop();
+		g_EventLoop.Stop();
+
+		const auto ps = g_PacketPool.GetStats();
+		printf("Packet pool: %u of %u in use, at most %u were in use, %llu came from the heap\n", ps.inUse, ps.capacity, ps.highWater, ps.fromHeap);
 
 		switch (caught_signal)
 		{
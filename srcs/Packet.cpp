@@ -18,59 +18,82 @@
 
 #include <cassert>
 
+#include "PacketPool.h"
 #include "Packet.h"
 #include "CRC.h"
 
 extern CCRC g_Crc;
+extern CPacketPool g_PacketPool;
+
+void *CPacket::operator new(size_t size)
+{
+	return g_PacketPool.Get(size);
+}
+
+void CPacket::operator delete(void *p)
+{
+	g_PacketPool.Put(p);
+}
 
 void CPacket::Initialize(EPacketType t, unsigned length)
 {
 	assert(EPacketType::none != t);
-	assert(length > 37u);
+	assert(length > 37u and length <= MAX_PACKET_SIZE);
 	ptype = t;
-	data.resize(length, 0);
+	// like resizing a vector, what's already there is kept and anything new is zero
+	if (length > size)
+		memset(data + size, 0, length - size);
+	size = length;
 	if (EPacketType::stream == t)
 	{
-		memcpy(data.data(), "M17 ", 4);
+		memcpy(data, "M17 ", 4);
 	} else if (EPacketType::packet == t) {
-		memcpy(data.data(), "M17P", 4);
+		memcpy(data, "M17P", 4);
 	}
 }
 
 void CPacket::Initialize(EPacketType t, const uint8_t *in, unsigned length)
 {
 	Initialize(t, length);
-	memcpy(data.data()+4, in+4, length-4);
+	memcpy(data+4, in+4, length-4);
+}
+
+void CPacket::Received(EPacketType t, unsigned length)
+{
+	assert(EPacketType::none != t);
+	assert(length > 37u and length <= MAX_PACKET_SIZE);
+	ptype = t;
+	size = length;
 }
 
 uint8_t *CPacket::GetDstAddress()
 {
-	return data.data() + ((EPacketType::stream == ptype) ? 6u : 4u);
+	return data + ((EPacketType::stream == ptype) ? 6u : 4u);
 }
 
 const uint8_t *CPacket::GetCDstAddress() const
 {
-	return data.data() + ((EPacketType::stream == ptype) ? 6u : 4u);
+	return data + ((EPacketType::stream == ptype) ? 6u : 4u);
 }
 
 uint8_t *CPacket::GetSrcAddress()
 {
-	return data.data() + ((EPacketType::stream == ptype) ? 12u : 10u);
+	return data + ((EPacketType::stream == ptype) ? 12u : 10u);
 }
 
 const uint8_t *CPacket::GetCSrcAddress() const
 {
-	return data.data() + ((EPacketType::stream == ptype) ? 12u : 10u);
+	return data + ((EPacketType::stream == ptype) ? 12u : 10u);
 }
 
 uint8_t *CPacket::GetMetaData()
 {
-	return data.data() + ((EPacketType::stream == ptype) ? 20 : 18);
+	return data + ((EPacketType::stream == ptype) ? 20 : 18);
 }
 
 const uint8_t *CPacket::GetCMetaData() const
 {
-	return data.data() + ((EPacketType::stream == ptype) ? 20 : 18);
+	return data + ((EPacketType::stream == ptype) ? 20 : 18);
 }
 
 // returns the StreamID in host byte order
@@ -118,7 +141,7 @@ uint16_t CPacket::GetCRC(bool first) const
 		if (first)
 			rval = get16At(32);
 		else
-			rval = get16At(data.size() - 2);
+			rval = get16At(size - 2);
 	}
 	return rval;
 }
@@ -134,17 +157,17 @@ void CPacket::SetFrameNumber(uint16_t fn)
 uint8_t *CPacket::GetPayload(bool firsthalf)
 {
 	if ((EPacketType::stream == ptype))
-		return data.data() + (firsthalf ? 36u : 44u);
+		return data + (firsthalf ? 36u : 44u);
 	else
-		return data.data() + 34;
+		return data + 34;
 }
 
 const uint8_t *CPacket::GetCPayload(bool firsthalf) const
 {
 	if ((EPacketType::stream == ptype))
-		return data.data() + (firsthalf ? 36u : 44u);
+		return data + (firsthalf ? 36u : 44u);
 	else
-		return data.data() + 34;
+		return data + 34;
 }
 
 bool CPacket::IsLastPacket() const
@@ -159,9 +182,9 @@ bool CPacket::CheckCRC() const
 {
 	if ((EPacketType::stream == ptype))
 	{
-		return (g_Crc.CheckCRC(data.data(), 54));
+		return (g_Crc.CheckCRC(data, 54));
 	} else {
-		return g_Crc.CheckCRC(data.data()+4, 30) or g_Crc.CheckCRC(data.data()+34, data.size()-34);
+		return g_Crc.CheckCRC(data+4, 30) or g_Crc.CheckCRC(data+34, size-34);
 	}
 }
 
@@ -169,13 +192,13 @@ void CPacket::CalcCRC()
 {
 	if ((EPacketType::stream == ptype))
 	{
-		g_Crc.SetCRC(data.data(), 54);
+		g_Crc.SetCRC(data, 54);
 	}
 	else
 	{	// set the g_Crc for the LSF
-		g_Crc.SetCRC(data.data()+4, 30);
+		g_Crc.SetCRC(data+4, 30);
 		// now for the payload
-		g_Crc.SetCRC(data.data()+34, data.size()-34);
+		g_Crc.SetCRC(data+34, size-34);
 	}
 }
 
@@ -21,7 +21,6 @@
 #include <cstdint>
 #include <string.h>
 #include <memory>
-#include <vector>
 
 #include "Callsign.h"
 
@@ -35,15 +34,23 @@ using SM17RefPacket = struct __attribute__((__packed__)) reflector_tag {
 
 enum class EPacketType { none, stream, packet };
 
+// The bytes are stored in the packet, so a new one doesn't have to allocate anything else,
+// and a CPacket made with new comes from, and goes back to, the packet pool.
 class CPacket
 {
 public:
+	static void *operator new(size_t size);
+	static void operator delete(void *p);
+
 	void Initialize(EPacketType t, unsigned length = 54);
 	void Initialize(EPacketType t, const uint8_t *in, unsigned length = 54);
-	void Reset(void) { data.clear(), ptype = EPacketType::none; }
+	// The first length bytes of GetData() already hold a packet of type t, it was received there.
+	// GetData() always has room for MAX_PACKET_SIZE bytes.
+	void Received(EPacketType t, unsigned length);
+	void Reset(void) { size = 0, ptype = EPacketType::none; }
 	// get pointer to different parts
-	      uint8_t *GetData()        { return data.data(); }
-	const uint8_t *GetCData() const { return data.data(); }
+	      uint8_t *GetData()        { return data; }
+	const uint8_t *GetCData() const { return data; }
 		  uint8_t *GetDstAddress();
 	const uint8_t *GetCDstAddress() const;
 	      uint8_t *GetSrcAddress();
@@ -65,7 +72,7 @@ public:
 	void SetFrameNumber(uint16_t fn);
 
 	// get the state data
-	size_t          GetSize() const { return data.size(); }
+	size_t          GetSize() const { return size; }
 	EPacketType     GetType() const { return ptype; }
 	bool       IsLastPacket() const;
 	bool           CheckCRC() const;
@@ -78,5 +85,6 @@ private:
 	void set16At(size_t pos, uint16_t val);
 
 	EPacketType ptype = EPacketType::none;
-	std::vector<uint8_t> data;
+	uint16_t size = 0;
+	uint8_t data[MAX_PACKET_SIZE];
 };
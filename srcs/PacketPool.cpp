@@ -0,0 +1,96 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <new>
+
+#include "PacketPool.h"
+
+// where the CPackets come from
+CPacketPool g_PacketPool;
+
+bool CPacketPool::Reserve(unsigned count)
+{
+	if (arena or 0u == count)
+		return false;
+	// each block is aligned for anything
+	const size_t size = (sizeof(CPacket) + alignof(std::max_align_t) - 1u) & ~(alignof(std::max_align_t) - 1u);
+	auto a = static_cast<unsigned char *>(::operator new(size * count, std::nothrow));
+	auto n = new (std::nothrow) std::atomic<uint32_t>[count];
+	if (nullptr == a or nullptr == n)
+	{
+		::operator delete(a);
+		delete[] n;
+		return true;
+	}
+	for (unsigned i=0; i<count; i++)
+		n[i].store((i + 1u < count) ? i + 1u : NONE, std::memory_order_relaxed);
+	blockSize = size;
+	next = n;
+	arena = a;
+	capacity = count;
+	head.store(0u, std::memory_order_release);
+	return false;
+}
+
+void *CPacketPool::Get(size_t size)
+{
+	if (size <= blockSize)
+	{
+		uint64_t h = head.load(std::memory_order_acquire);
+		while (NONE != uint32_t(h))
+		{
+			const uint32_t i = uint32_t(h);
+			const uint64_t n = (((h >> 32) + 1u) << 32) | next[i].load(std::memory_order_relaxed);
+			if (head.compare_exchange_weak(h, n, std::memory_order_acquire, std::memory_order_acquire))
+			{
+				const unsigned used = inUse.fetch_add(1u, std::memory_order_relaxed) + 1u;
+				unsigned hw = highWater.load(std::memory_order_relaxed);
+				while (used > hw and not highWater.compare_exchange_weak(hw, used, std::memory_order_relaxed))
+					;
+				return arena + i * blockSize;
+			}
+		}
+	}
+	fromHeap.fetch_add(1u, std::memory_order_relaxed);
+	return ::operator new(size);
+}
+
+void CPacketPool::Put(void *p)
+{
+	auto b = static_cast<unsigned char *>(p);
+	if (nullptr == arena or b < arena or b >= arena + capacity * blockSize)
+	{
+		::operator delete(p);
+		return;
+	}
+	const uint32_t i = uint32_t((b - arena) / blockSize);
+	uint64_t h = head.load(std::memory_order_relaxed);
+	uint64_t n;
+	do
+	{
+		next[i].store(uint32_t(h), std::memory_order_relaxed);
+		n = (((h >> 32) + 1u) << 32) | i;
+	} while (not head.compare_exchange_weak(h, n, std::memory_order_release, std::memory_order_relaxed));
+	inUse.fetch_sub(1u, std::memory_order_relaxed);
+}
+
+SPacketPoolStats CPacketPool::GetStats() const
+{
+	return SPacketPoolStats { capacity, inUse.load(), highWater.load(), fromHeap.load() };
+}
@@ -0,0 +1,64 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#include "Packet.h"
+
+using SPacketPoolStats = struct packetpoolstats_tag
+{
+	unsigned capacity, inUse, highWater;
+	unsigned long long fromHeap;
+};
+
+// A fixed number of CPacket sized blocks, made once, that every new CPacket comes from.
+// Each block has room for the whole packet, a 54 byte stream frame or a MAX_PACKET_SIZE
+// packet mode frame, so there is nothing else to allocate. Get() and Put() are lock-free,
+// the free blocks are a stack of indices. If the pool is empty, or not reserved yet, the
+// block comes from the heap, and that's counted in the stats.
+// The storage is never freed and the destructor is trivial, so packets that are still in
+// a global queue at exit can be freed in any order.
+class CPacketPool
+{
+public:
+	constexpr CPacketPool() {}
+
+	// make the blocks, only the first call does anything, returns true on error
+	bool Reserve(unsigned count);
+	void *Get(size_t size);
+	void Put(void *p);
+	SPacketPoolStats GetStats() const;
+
+private:
+	static constexpr uint32_t NONE = 0xffffffffu;
+
+	// the index of the top free block is in the low 32 bits, the high 32 bits are a tag
+	// that changes every time, so a compare and swap can't be fooled by a recycled index
+	std::atomic<uint64_t> head { NONE };
+	std::atomic<uint32_t> *next = nullptr;
+	unsigned char *arena = nullptr;
+	size_t blockSize = 0;
+	unsigned capacity = 0;
+	std::atomic<unsigned> inUse { 0 }, highWater { 0 };
+	std::atomic<unsigned long long> fromHeap { 0 };
+};
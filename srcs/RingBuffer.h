@@ -18,36 +18,57 @@
 
 #pragma once
 
+#include <cstddef>
+
+// A mirrored ring buffer: every item is written twice, size elements apart,
+// so the last size items are always available as one contiguous array,
+// oldest first, starting at Data(). No modulo is needed to read anything.
+// If size is a power of two, the write position wraps with a mask.
 template <typename T, size_t size>
 class RingBuffer
 {
 public:
 	void Push(const T& item)
 	{
-		buffer[position++] = item;
-		position %= capacity;
+		buffer[position] = item;
+		buffer[position + size] = item;
+		if constexpr (0 == (size & (size - 1)))
+			position = (position + 1) & (size - 1);
+		else if (++position == size)
+			position = 0;
 	}
 
-	// Get an element from the buffer
+	// Get an element from the buffer, 0 is the oldest
 	T operator[](unsigned index) const
 	{
-		return buffer[(index + position) % capacity];
+		return buffer[position + index];
+	}
+
+	// a contiguous view of the whole buffer, oldest first
+	const T *Data(void) const
+	{
+		return buffer + position;
+	}
+
+	// a contiguous view of the newest n elements, oldest first
+	const T *Last(size_t n) const
+	{
+		return buffer + position + size - n;
 	}
 
 	size_t Size(void) const
 	{
-		return capacity;
+		return size;
 	}
 
 	void Clear(void)
 	{
-		for (size_t i = 0; i<size; i++)
+		for (size_t i = 0; i<2*size; i++)
 			buffer[i] = 0;
 		position = 0;
 	}
 
 private:
-	T buffer[size] { 0 };
-	const size_t capacity { size };
-	size_t position = 0; // current position
+	T buffer[2 * size] { 0 };
+	size_t position = 0; // current position, this is the oldest item
 };
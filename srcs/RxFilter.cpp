@@ -0,0 +1,180 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+//libm17
+#include <m17.h>
+
+#include "RxFilter.h"
+
+template <>
+CRxFilter<float>::CRxFilter(float g) : gain(g)
+{
+	memcpy(taps, rrc_taps_5, sizeof(taps));
+	Reset();
+}
+
+// The gain is folded into the taps, using as many fractional bits as will fit.
+template <>
+CRxFilter<int16_t>::CRxFilter(float g) : gain(g)
+{
+	float peak = 0.0f;
+	for (unsigned i=0; i<RX_FLT_LEN; i++)
+		peak = std::max(peak, std::fabs(rrc_taps_5[i] * gain));
+	shift = 20;
+	while (shift > 9 and peak * float(1 << shift) > 32000.0f)
+		shift--;
+	for (unsigned i=0; i<RX_FLT_LEN; i++)
+		taps[i] = int16_t(lrintf(rrc_taps_5[i] * gain * float(1 << shift)));
+	Reset();
+}
+
+template <typename T>
+void CRxFilter<T>::Reset()
+{
+	memset(hist, 0, sizeof(hist));
+}
+
+// NOTE: The products and sums below must stay separate operations, in the same order
+// as the scalar loop, so the output is bit-for-bit what the scalar filter produces.
+// Do not build with -ffp-contract=fast (-std=gnu++17) or fused multiply-adds will change the rounding.
+template <>
+void CRxFilter<float>::Filter(float *out, const int8_t *in)
+{
+	// append the new block to the history
+	float *x = hist + RX_FLT_LEN - 1;
+	for (unsigned n=0; n<RX_BLOCK_LEN; n++)
+		x[n] = float(in[n]);
+
+	// x[n-RX_FLT_LEN+1] is the oldest sample for output n
+	const float *h = hist;
+	unsigned n = 0;
+
+#if defined(__ARM_NEON)
+	const float32x4_t vg = vdupq_n_f32(gain);
+	for ( ; n+4<=RX_BLOCK_LEN; n+=4)
+	{
+		float32x4_t acc = vdupq_n_f32(0.0f);
+		for (unsigned i=0; i<RX_FLT_LEN; i++)
+			acc = vaddq_f32(acc, vmulq_f32(vdupq_n_f32(taps[i]), vld1q_f32(h+n+i)));
+		vst1q_f32(out+n, vmulq_f32(acc, vg));
+	}
+#elif defined(__AVX__)
+	const __m256 vg = _mm256_set1_ps(gain);
+	for ( ; n+8<=RX_BLOCK_LEN; n+=8)
+	{
+		__m256 acc = _mm256_setzero_ps();
+		for (unsigned i=0; i<RX_FLT_LEN; i++)
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(taps[i]), _mm256_loadu_ps(h+n+i)));
+		_mm256_storeu_ps(out+n, _mm256_mul_ps(acc, vg));
+	}
+#elif defined(__SSE__)
+	const __m128 vg = _mm_set1_ps(gain);
+	for ( ; n+4<=RX_BLOCK_LEN; n+=4)
+	{
+		__m128 acc = _mm_setzero_ps();
+		for (unsigned i=0; i<RX_FLT_LEN; i++)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps[i]), _mm_loadu_ps(h+n+i)));
+		_mm_storeu_ps(out+n, _mm_mul_ps(acc, vg));
+	}
+#endif
+
+	// scalar filter for anything left over (or everything, on other machines)
+	for ( ; n<RX_BLOCK_LEN; n++)
+	{
+		float acc = 0.0f;
+		for (unsigned i=0; i<RX_FLT_LEN; i++)
+			acc += taps[i] * h[n+i];
+		out[n] = acc * gain;
+	}
+
+	// slide the tail of this block to the front for next time
+	memmove(hist, hist + RX_BLOCK_LEN, (RX_FLT_LEN - 1) * sizeof(float));
+}
+
+// Integer products and sums are exact, so the vector and scalar versions agree whatever the order.
+template <>
+void CRxFilter<int16_t>::Filter(int16_t *out, const int8_t *in)
+{
+	int16_t *x = hist + RX_FLT_LEN - 1;
+	for (unsigned n=0; n<RX_BLOCK_LEN; n++)
+		x[n] = in[n];
+
+	const int16_t *h = hist;
+	// the accumulator has shift fractional bits, the output has 8
+	const int osh = shift - 8;
+	unsigned n = 0;
+
+#if defined(__ARM_NEON)
+	const int32x4_t vsh = vdupq_n_s32(-osh); // a negative left shift is a rounding right shift
+	for ( ; n+8<=RX_BLOCK_LEN; n+=8)
+	{
+		int32x4_t lo = vdupq_n_s32(0), hi = vdupq_n_s32(0);
+		for (unsigned i=0; i<RX_FLT_LEN; i++)
+		{
+			const int16x8_t v = vld1q_s16(h+n+i);
+			const int16x4_t t = vdup_n_s16(taps[i]);
+			lo = vmlal_s16(lo, vget_low_s16(v),  t);
+			hi = vmlal_s16(hi, vget_high_s16(v), t);
+		}
+		vst1q_s16(out+n, vcombine_s16(vqmovn_s32(vrshlq_s32(lo, vsh)), vqmovn_s32(vrshlq_s32(hi, vsh))));
+	}
+#elif defined(__SSE2__)
+	const __m128i vrnd = _mm_set1_epi32(1 << (osh - 1));
+	const __m128i vsh  = _mm_cvtsi32_si128(osh);
+	for ( ; n+8<=RX_BLOCK_LEN; n+=8)
+	{
+		__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+		for (unsigned i=0; i<RX_FLT_LEN; i++)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i *)(h+n+i));
+			const __m128i t = _mm_set1_epi16(taps[i]);
+			const __m128i pl = _mm_mullo_epi16(v, t);
+			const __m128i ph = _mm_mulhi_epi16(v, t);
+			lo = _mm_add_epi32(lo, _mm_unpacklo_epi16(pl, ph));
+			hi = _mm_add_epi32(hi, _mm_unpackhi_epi16(pl, ph));
+		}
+		lo = _mm_sra_epi32(_mm_add_epi32(lo, vrnd), vsh);
+		hi = _mm_sra_epi32(_mm_add_epi32(hi, vrnd), vsh);
+		_mm_storeu_si128((__m128i *)(out+n), _mm_packs_epi32(lo, hi));
+	}
+#endif
+
+	for ( ; n<RX_BLOCK_LEN; n++)
+	{
+		int32_t acc = 0;
+		for (unsigned i=0; i<RX_FLT_LEN; i++)
+			acc += int32_t(taps[i]) * h[n+i];
+		acc = (acc + (1 << (osh - 1))) >> osh;
+		out[n] = int16_t(std::clamp(acc, int32_t(INT16_MIN), int32_t(INT16_MAX)));
+	}
+
+	memmove(hist, hist + RX_BLOCK_LEN, (RX_FLT_LEN - 1) * sizeof(int16_t));
+}
+
+template class CRxFilter<float>;
+template class CRxFilter<int16_t>;
@@ -0,0 +1,64 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#define RX_FLT_LEN   41		// length of the RRC matched filter, 8 symbols at 5 samples per symbol, plus one
+#define RX_BLOCK_LEN 960	// the number of baseband samples in each CMD_RX_DATA frame
+
+// The demodulator works either in float, or, when built with RX_FIXED_POINT,
+// in fixed-point: the filtered samples are int16 with 8 fractional bits and
+// squared distances are int32 with 16 fractional bits.
+#ifdef RX_FIXED_POINT
+using rxsample_t = int16_t;
+using rxsed_t    = int32_t;
+constexpr rxsample_t RX_SAMPLE_ONE = 256;
+constexpr rxsed_t    RX_SED_ONE    = 65536;
+#else
+using rxsample_t = float;
+using rxsed_t    = float;
+constexpr rxsample_t RX_SAMPLE_ONE = 1.0f;
+constexpr rxsed_t    RX_SED_ONE    = 1.0f;
+#endif
+constexpr rxsed_t    RX_SED_MAX    = std::numeric_limits<rxsed_t>::max();
+
+// The RX root-raised-cosine matched filter.
+// A whole block of baseband samples is filtered at once from a linear history buffer:
+// the last RX_FLT_LEN-1 samples of the previous block sit just in front of the new block,
+// so every output is a plain dot product over contiguous memory. The block is vectorized
+// across output samples (NEON on ARM, AVX or SSE on x86).
+// CRxFilter<float> accumulates each output in exactly the same order as the scalar filter, so the results are bit-identical.
+// CRxFilter<int16_t> folds the gain into int16 taps, accumulates in int32 and outputs samples in units of 1/RX_SAMPLE_ONE.
+template <typename T>
+class CRxFilter
+{
+public:
+	CRxFilter(float gain);
+	void Reset();
+	// filter RX_BLOCK_LEN int8 samples from in to out, the output is scaled by gain
+	void Filter(T *out, const int8_t *in);
+
+private:
+	alignas(32) T taps[RX_FLT_LEN];
+	alignas(32) T hist[RX_FLT_LEN - 1 + RX_BLOCK_LEN];
+	const float gain;
+	int shift = 0; // fixed-point only, the number of fractional bits in the taps
+};
@@ -24,8 +24,11 @@
 #include <memory>
 #include <thread>
 
+#include "EventLoop.h"
 #include "Packet.h"
 
+extern CEventLoop g_EventLoop;
+
 template <class T>
 class CSafePacketQueue
 {
@@ -39,6 +42,35 @@ public:
 		std::lock_guard<std::mutex> lock(m);
 		q.push(std::move(t));
 		c.notify_one();
+		g_EventLoop.Notify(notifier);
+	}
+
+	// a consumer on the event loop gets this notifier poked on every Push(), -1 for none
+	void SetNotifier(int n)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		notifier = n;
+	}
+
+	// the oldest item, or if the queue is empty, a nullptr, it never waits
+	T Pop(void)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		T val;
+		if (not q.empty())
+		{
+			val = std::move(q.front());
+			q.pop();
+		}
+		return val;
+	}
+
+	// make a waiting PopWaitFor() return, even if the queue is empty
+	void Wake(void)
+	{
+		std::lock_guard<std::mutex> lock(m);
+		woken = true;
+		c.notify_all();
 	}
 
 	// If the queue is empty, wait until an element is available.
@@ -55,12 +87,18 @@ public:
 		return val;
 	}
 
-	// wait for some time, or until an element is available.
+	// wait for some time, or until an element is available, or until Wake(). A negative ms waits without a timeout.
 	T PopWaitFor(int ms)
 	{
 		std::unique_lock<std::mutex> lock(m);
 		T val;
-		if (c.wait_for(lock, std::chrono::milliseconds(ms), [this] { return not q.empty(); }))
+		const auto ready = [this] { return woken or not q.empty(); };
+		if (ms < 0)
+			c.wait(lock, ready);
+		else
+			c.wait_for(lock, std::chrono::milliseconds(ms), ready);
+		woken = false;
+		if (not q.empty())
 		{
 			val = std::move(q.front());
 			q.pop();
@@ -91,6 +129,8 @@ private:
 	std::queue<T> q;
 	mutable std::mutex m;
 	std::condition_variable c;
+	bool woken = false;
+	int notifier = -1;
 };
 
 using IPFrameFIFO  = CSafePacketQueue<std::unique_ptr<CPacket>>;
@@ -0,0 +1,100 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+
+// A preallocated, lock-free, single-producer/single-consumer queue of fixed size elements.
+// The producer fills an element in place and then commits it, the consumer uses an element in place
+// and then releases it, so nothing is ever copied or allocated. The mutex and condition variable
+// are only used to put an idle consumer to sleep, the producer only touches them when it has to wake it up.
+// size must be a power of two.
+template <class T, std::size_t size>
+class CSpscQueue
+{
+	static_assert(size and 0u == (size & (size - 1u)), "CSpscQueue size must be a power of two");
+
+public:
+	// producer: the next free element, or nullptr if the queue is full
+	T *Back()
+	{
+		const auto t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == size)
+			return nullptr;
+		return &slot[t & (size - 1u)];
+	}
+
+	// producer: publish the element returned by Back()
+	void Push()
+	{
+		tail.fetch_add(1u, std::memory_order_seq_cst);
+		if (sleeping.load(std::memory_order_seq_cst))
+		{
+			std::lock_guard<std::mutex> lock(m);
+			c.notify_one();
+		}
+	}
+
+	// consumer: the oldest element, or nullptr if the queue is empty
+	const T *Front() const
+	{
+		const auto h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return nullptr;
+		return &slot[h & (size - 1u)];
+	}
+
+	// consumer: give the element returned by Front() back to the producer
+	void Pop()
+	{
+		head.fetch_add(1u, std::memory_order_release);
+	}
+
+	// consumer: wait for some time, or until an element is available, returns true if one is
+	bool WaitFor(int ms)
+	{
+		if (Front())
+			return true;
+		std::unique_lock<std::mutex> lock(m);
+		sleeping.store(true, std::memory_order_seq_cst);
+		// this load of tail and the one of sleeping in Push() are both seq_cst, so a Push() can't be missed
+		const bool rv = c.wait_for(lock, std::chrono::milliseconds(ms), [this] { return head.load(std::memory_order_relaxed) != tail.load(std::memory_order_seq_cst); });
+		sleeping.store(false, std::memory_order_relaxed);
+		return rv;
+	}
+
+	// the number of elements waiting for the consumer
+	std::size_t Count() const
+	{
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+private:
+	T slot[size];
+	// head and tail only ever increase, they're masked to index the slots
+	alignas(64) std::atomic<std::size_t> head { 0 };
+	alignas(64) std::atomic<std::size_t> tail { 0 };
+	std::atomic<bool> sleeping { false };
+	std::mutex m;
+	std::condition_variable c;
+};
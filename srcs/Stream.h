@@ -23,7 +23,6 @@
 
 #include "SteadyTimer.h"
 #include "Callsign.h"
-#include "MspotDB.h"
 #include "Base.h"
 
 enum class EStreamType { gate, modem };
@@ -35,7 +34,9 @@ public:
 	~CStream() {}
 	void Initialize(EStreamType t);
 	void OpenStream(const std::string &src, uint16_t id, const std::string &from);
-	void CloseStream(bool isTimeout, CMspotDB &db);
+	// returns the frame count, for the last heard
+	unsigned CloseStream(bool isTimeout);
+	const std::string &GetSource() const { return src; }
 	bool IsOpen();
 	double GetLastTime();
 	uint16_t GetStreamID();
@@ -17,6 +17,7 @@
 */
 
 #include <string.h>
+#include <algorithm>
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -24,6 +25,7 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
 
 #include "UDPSocket.h"
 
@@ -61,6 +63,18 @@ bool CUDPSocket::Open(const CSockAddress &addr)
 		return true;
 	}
 
+	// room for bursts, the kernel might give us less than this, see net.core.rmem_max and wmem_max
+	for (int opt : { SO_RCVBUF, SO_SNDBUF })
+	{
+		const int want = (SO_RCVBUF == opt) ? UDP_RCVBUF_SIZE : UDP_SNDBUF_SIZE;
+		int have = 0;
+		socklen_t len = sizeof(have);
+		if (setsockopt(m_fd, SOL_SOCKET, opt, &want, sizeof(want)) or getsockopt(m_fd, SOL_SOCKET, opt, &have, &len))
+			Log(EUnit::udp, "setsockopt(%s) on %s err: %s\n", (SO_RCVBUF == opt) ? "SO_RCVBUF" : "SO_SNDBUF", addr.GetAddress(), strerror(errno));
+		else if (have < want) // linux reports double what was set
+			Log(EUnit::udp, "%s on %s is only %d bytes\n", (SO_RCVBUF == opt) ? "SO_RCVBUF" : "SO_SNDBUF", addr.GetAddress(), have);
+	}
+
 	// initialize sockaddr struct
 	m_addr = addr;
 
@@ -125,3 +139,122 @@ ssize_t CUDPSocket::Write(const void *Buffer, const size_t size, const CSockAddr
 		Log(EUnit::udp, "Short Write, %d < %u to %s\n", rval, size, Ip.GetAddress());
 	return rval;
 }
+
+unsigned CUDPSocket::ReadMany(SDatagram *dgrams, unsigned count, size_t bufsize)
+{
+	if (0 > m_fd)
+		return 0;
+	count = std::min(count, UDP_BATCH_MAX);
+
+	struct mmsghdr msgs[UDP_BATCH_MAX];
+	struct iovec iovs[UDP_BATCH_MAX];
+	memset(msgs, 0, sizeof(msgs));
+	for (unsigned i=0; i<count; i++)
+	{
+		iovs[i].iov_base = dgrams[i].buf;
+		iovs[i].iov_len = bufsize;
+		msgs[i].msg_hdr.msg_name = dgrams[i].addr.GetPointer();
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	const int n = recvmmsg(m_fd, msgs, count, MSG_DONTWAIT, nullptr);
+	if (0 > n)
+	{
+		if (EAGAIN != errno and EWOULDBLOCK != errno and EINTR != errno)
+			Log(EUnit::udp, "recvmmsg() error on %s: %s\n", m_addr.GetAddress(), strerror(errno));
+		return 0;
+	}
+
+	for (int i=0; i<n; i++)
+	{
+		dgrams[i].size = msgs[i].msg_len;
+		if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+		{
+			Log(EUnit::udp, "Dropped a datagram from %s, it's larger than %u bytes\n", dgrams[i].addr.GetAddress(), unsigned(bufsize));
+			dgrams[i].size = 0;
+		}
+	}
+	return unsigned(n);
+}
+
+void CUDPSocket::Queue(const void *buf, const size_t size, const CSockAddress &addr, unsigned dscp)
+{
+	if (size > UDP_BUFFER_LENMAX)
+	{
+		Log(EUnit::udp, "Can't send %u bytes to %s, it's too long\n", unsigned(size), addr.GetAddress());
+		return;
+	}
+	if (UDP_BATCH_MAX == m_outCount)
+		Flush();
+	auto &o = m_out[m_outCount++];
+	memcpy(o.data, buf, size);
+	o.size = size;
+	o.addr = addr;
+	o.tos = int(dscp << 2); // the DSCP is the top six bits of the TOS, or the traffic class
+}
+
+void CUDPSocket::Flush(void)
+{
+	if (0 == m_outCount)
+		return;
+	if (0 > m_fd)
+	{
+		m_outCount = 0;
+		return;
+	}
+
+	struct mmsghdr msgs[UDP_BATCH_MAX];
+	struct iovec iovs[UDP_BATCH_MAX];
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctrl[UDP_BATCH_MAX];
+	memset(msgs, 0, sizeof(msgs));
+	for (unsigned i=0; i<m_outCount; i++)
+	{
+		auto &o = m_out[i];
+		iovs[i].iov_base = o.data;
+		iovs[i].iov_len = o.size;
+		msgs[i].msg_hdr.msg_name = const_cast<struct sockaddr *>(o.addr.GetCPointer());
+		msgs[i].msg_hdr.msg_namelen = o.addr.GetSize();
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (o.tos)
+		{
+			// mark just this datagram, with IP_TOS or IPV6_TCLASS
+			memset(ctrl[i].buf, 0, sizeof(ctrl[i].buf));
+			msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+			auto cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			cmsg->cmsg_level = (AF_INET6 == o.addr.GetFamily()) ? IPPROTO_IPV6 : IPPROTO_IP;
+			cmsg->cmsg_type  = (AF_INET6 == o.addr.GetFamily()) ? IPV6_TCLASS : IP_TOS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &o.tos, sizeof(int));
+		}
+	}
+
+	unsigned sent = 0;
+	while (sent < m_outCount)
+	{
+		const int n = sendmmsg(m_fd, msgs + sent, m_outCount - sent, 0);
+		if (0 > n)
+		{
+			if (EINTR == errno)
+				continue;
+			// skip the one that failed, the rest might still go
+			Log(EUnit::udp, "sendmmsg() error on %s to %s: %s\n", m_addr.GetAddress(), m_out[sent].addr.GetAddress(), strerror(errno));
+			sent++;
+			continue;
+		}
+		for (int i=0; i<n; i++)
+		{
+			if (msgs[sent+i].msg_len != m_out[sent+i].size)
+				Log(EUnit::udp, "Short Write, %u < %u to %s\n", msgs[sent+i].msg_len, unsigned(m_out[sent+i].size), m_out[sent+i].addr.GetAddress());
+		}
+		sent += unsigned(n);
+	}
+	m_outCount = 0;
+}
@@ -18,10 +18,27 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "SockAddress.h"
 #include "Base.h"
 
 #define UDP_BUFFER_LENMAX 1024
+// the most datagrams read, or sent, with one system call
+#define UDP_BATCH_MAX 16u
+// the kernel's socket buffers, the receive side can hold a burst of several hundred frames
+#define UDP_RCVBUF_SIZE 262144
+#define UDP_SNDBUF_SIZE 65536
+// the DiffServ Expedited Forwarding code point, for voice
+#define DSCP_EF 46u
+
+// one datagram for ReadMany(), buf is where it's received
+using SDatagram = struct datagram_tag
+{
+	uint8_t *buf;
+	size_t size;
+	CSockAddress addr;
+};
 
 class CUDPSocket : public CBase
 {
@@ -39,7 +56,26 @@ public:
 	ssize_t Read(unsigned char *buf, const size_t size, CSockAddress &addr);
 	ssize_t Write(const void *buf, const size_t size, const CSockAddress &addr) const;
 
+	// Read up to count datagrams with one recvmmsg(), without waiting. Each one can be up to bufsize bytes,
+	// a larger one is dropped. Returns how many were read, fewer than count means the socket is drained.
+	unsigned ReadMany(SDatagram *dgrams, unsigned count, size_t bufsize);
+	// Copy a datagram to the send queue, a non-zero dscp marks it with that DiffServ code point.
+	// The queue goes out with one sendmmsg() on Flush(), or when it's full.
+	void Queue(const void *buf, const size_t size, const CSockAddress &addr, unsigned dscp = 0);
+	void Flush(void);
+
 protected:
 	int m_fd;
 	CSockAddress m_addr;
+
+private:
+	using SOutgoing = struct outgoing_tag
+	{
+		uint8_t data[UDP_BUFFER_LENMAX];
+		size_t size;
+		CSockAddress addr;
+		int tos;
+	};
+	SOutgoing m_out[UDP_BATCH_MAX];
+	unsigned m_outCount = 0;
 };
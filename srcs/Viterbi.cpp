@@ -0,0 +1,292 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include "Viterbi.h"
+
+// Four 32-bit lanes, GCC and clang turn these into NEON or SSE instructions.
+// The path metrics never get anywhere near 2^31, so they're signed to get the fastest compares.
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+static inline v4si splat(int32_t x)
+{
+	return v4si { x, x, x, x };
+}
+
+static inline v4si select(v4si mask, v4si a, v4si b)
+{
+	return (a & mask) | (b & ~mask);
+}
+
+static inline v4si interleaveLo(v4si a, v4si b)
+{
+#if defined(__clang__)
+	return __builtin_shufflevector(a, b, 0, 4, 1, 5);
+#else
+	return __builtin_shuffle(a, b, v4si { 0, 4, 1, 5 });
+#endif
+}
+
+static inline v4si interleaveHi(v4si a, v4si b)
+{
+#if defined(__clang__)
+	return __builtin_shufflevector(a, b, 2, 6, 3, 7);
+#else
+	return __builtin_shuffle(a, b, v4si { 2, 6, 3, 7 });
+#endif
+}
+
+static inline int32_t horizontalOr(v4si a)
+{
+	return a[0] | a[1] | a[2] | a[3];
+}
+
+void CViterbi::softBits(uint16_t d_soft_bit[2*SYM_PER_PLD], const float pld_symbs[SYM_PER_PLD]) const
+{
+	uint16_t soft_bit[2*SYM_PER_PLD];
+	// slice symbols to soft dibits
+	slice_symbols(soft_bit, pld_symbs);
+	// derandomize
+	randomize_soft_bits(soft_bit);
+	// deinterleave
+	reorder_soft_bits(d_soft_bit, soft_bit);
+}
+
+uint32_t CViterbi::DecodeLSF(lsf_t *lsf, const float pld_symbs[SYM_PER_PLD])
+{
+	uint16_t d_soft_bit[2*SYM_PER_PLD];
+	uint8_t lsf_b[30+1]; // the first byte is the encoded flushing bits
+
+	softBits(d_soft_bit, pld_symbs);
+	auto e = DecodePunctured(lsf_b, d_soft_bit, puncture_pattern_1, 2*SYM_PER_PLD, sizeof(puncture_pattern_1));
+	memcpy(lsf, lsf_b+1, 30);
+	return e;
+}
+
+uint32_t CViterbi::DecodeStream(uint8_t frame_data[16], uint8_t lich[6], uint16_t *fn, uint8_t *lich_cnt, const float pld_symbs[SYM_PER_PLD])
+{
+	uint16_t d_soft_bit[2*SYM_PER_PLD];
+	uint8_t tmp[(16+128)/8+1];
+
+	softBits(d_soft_bit, pld_symbs);
+	// the first 96 soft bits are the Golay encoded LICH
+	decode_LICH(lich, d_soft_bit);
+	*lich_cnt = lich[5] >> 5;
+	auto e = DecodePunctured(tmp, d_soft_bit+96, puncture_pattern_2, 2*SYM_PER_PLD-96, sizeof(puncture_pattern_2));
+	*fn = (tmp[1] << 8) | tmp[2];
+	memcpy(frame_data, tmp+3, 16);
+	return e;
+}
+
+uint32_t CViterbi::DecodePacket(uint8_t frame_data[25], uint8_t *eof, uint8_t *fn, const float pld_symbs[SYM_PER_PLD])
+{
+	uint16_t d_soft_bit[2*SYM_PER_PLD];
+	uint8_t tmp[(8+200+6+4)/8+1];
+
+	softBits(d_soft_bit, pld_symbs);
+	auto e = DecodePunctured(tmp, d_soft_bit, puncture_pattern_3, 2*SYM_PER_PLD, sizeof(puncture_pattern_3));
+	// the 6 bits after the data are the EOF flag and the frame number, or byte count
+	*eof = tmp[26] >> 7;
+	*fn = (tmp[26] >> 2) & 0x1Fu;
+	memcpy(frame_data, tmp+1, 25);
+	return e;
+}
+
+uint32_t CViterbi::DecodePunctured(uint8_t *out, const uint16_t *in, const uint8_t *punct, const uint16_t in_len, const uint16_t p_len)
+{
+	if (in_len > 2*VITERBI_MAX_STEPS or 0u == p_len)
+		return 0;
+
+	// put the punctured bits back as erasures, halfway between 0 and 1
+	uint16_t umsg[2*VITERBI_MAX_STEPS];
+	uint16_t u = 0, p = 0;
+	for (uint16_t i=0; i<in_len; )
+	{
+		if (u >= 2*VITERBI_MAX_STEPS)
+			return 0;	// the erasures would make it longer than the trellis
+		umsg[u++] = punct[p] ? in[i++] : 0x7FFFu;
+		if (++p == p_len)
+			p = 0;
+	}
+
+	// the erasures each add 0x7FFF to the path metric, take them out again
+	return decode(out, umsg, u) - (u - in_len) * 0x7FFFu;
+}
+
+uint32_t CViterbi::decode(uint8_t *out, const uint16_t *in, const uint16_t len)
+{
+	// The path metrics of the 16 states: pm[0] and pm[1] are states 0-7, pm[2] and pm[3] are states 8-15.
+	// Butterfly i (0-7) goes from states i and i+8 to states 2i and 2i+1. Butterflies 0-3 are the "a" lanes,
+	// butterflies 4-7 are the "b" lanes.
+	v4si pm[4] { splat(0), splat(0), splat(0), splat(0) };
+	// the encoder's output for a 0 bit out of each butterfly's lower state, as soft bits
+	const v4si c0a { 0, 0, 0, 0 }, c0b { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF };
+	const v4si c1a { 0, 0xFFFF, 0xFFFF, 0 }, c1b { 0, 0xFFFF, 0xFFFF, 0 };
+	// where each butterfly's decisions go in the history word
+	const v4si bits0 { 1, 4, 16, 64 }, bits1 { 2, 8, 32, 128 };
+	const v4si mmax = splat(0x1FFFE);
+
+	const unsigned steps = len / 2;
+	for (unsigned pos=0; pos<steps; pos++)
+	{
+		const v4si s0 = splat(in[2*pos]);
+		const v4si s1 = splat(in[2*pos+1]);
+		// the branch metric is |c - s|, with c either 0 or 0xFFFF, that's just s ^ c
+		const v4si ma = (s0 ^ c0a) + (s1 ^ c1a);
+		const v4si mb = (s0 ^ c0b) + (s1 ^ c1b);
+
+		// ties go to the upper state, same as libm17
+		const v4si m0a = pm[0] + ma, m1a = pm[2] + (mmax - ma);
+		const v4si m2a = pm[0] + (mmax - ma), m3a = pm[2] + ma;
+		const v4si m0b = pm[1] + mb, m1b = pm[3] + (mmax - mb);
+		const v4si m2b = pm[1] + (mmax - mb), m3b = pm[3] + mb;
+		const v4si d0a = m0a >= m1a, d1a = m2a >= m3a;
+		const v4si d0b = m0b >= m1b, d1b = m2b >= m3b;
+		const v4si n0a = select(d0a, m1a, m0a), n1a = select(d1a, m3a, m2a);
+		const v4si n0b = select(d0b, m1b, m0b), n1b = select(d1b, m3b, m2b);
+
+		history[pos] = uint16_t(horizontalOr((d0a & bits0) | (d1a & bits1)) | (horizontalOr((d0b & bits0) | (d1b & bits1)) << 8));
+
+		pm[0] = interleaveLo(n0a, n1a);
+		pm[1] = interleaveHi(n0a, n1a);
+		pm[2] = interleaveLo(n0b, n1b);
+		pm[3] = interleaveHi(n0b, n1b);
+	}
+
+	// chainback from state 0, the encoder was flushed
+	memset(out, 0, (steps-1)/8+1);
+	uint8_t state = 0;
+	unsigned bitPos = steps + 4;
+	for (unsigned pos=steps; pos>0; )
+	{
+		bitPos--;
+		pos--;
+		const bool bit = history[pos] & (1u << (state >> 4));
+		state >>= 1;
+		if (bit)
+		{
+			state |= 0x80u;
+			out[bitPos/8] |= 1u << (7 - (bitPos % 8));
+		}
+	}
+
+	// the error metric is the smallest path metric
+	v4si m = select(pm[0] < pm[1], pm[0], pm[1]);
+	m = select(m < pm[2], m, pm[2]);
+	m = select(m < pm[3], m, pm[3]);
+	int32_t cost = m[0];
+	for (unsigned i=1; i<4; i++)
+		if (m[i] < cost)
+			cost = m[i];
+	return uint32_t(cost);
+}
+
+#ifdef VITERBI_BENCH
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+
+// Decode the same noisy frames with libm17 and with CViterbi, check that they agree, then compare their speed.
+int main(int argc, char *argv[])
+{
+	const unsigned count = (argc > 1) ? unsigned(atoi(argv[1])) : 10000u;
+	if (0u == count)
+	{
+		fprintf(stderr, "Usage: %s [NumberOfFrames]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 rng(17);
+	std::normal_distribution<float> noise(0.0f, 0.4f);
+
+	// one LSF, stream and packet frame, each with a few noisy copies
+	const unsigned copies = 16;
+	static float pld[3][copies][SYM_PER_PLD];
+	uint8_t lsf[30], data[26];
+	for (auto &b : lsf)
+		b = uint8_t(rng());
+	for (auto &b : data)
+		b = uint8_t(rng());
+	for (unsigned t=0; t<3; t++)
+	{
+		int8_t frame[SYM_PER_FRA];
+		gen_frame_i8(frame, data, (0u==t) ? FRAME_LSF : ((1u==t) ? FRAME_STR : FRAME_PKT), (const lsf_t *)lsf, 2, 0x1234u);
+		for (unsigned c=0; c<copies; c++)
+			for (unsigned i=0; i<SYM_PER_PLD; i++)
+				pld[t][c][i] = frame[SYM_PER_SWD+i] + ((c) ? noise(rng) : 0.0f);
+	}
+
+	CViterbi viterbi;
+	// decode a frame with libm17 (0) or CViterbi (1), returns the error metric
+	auto decodeFrame = [&](unsigned which, unsigned t, const float *p, uint8_t *out) -> uint32_t
+	{
+		uint8_t lich[6], lich_cnt, eof, pfn;
+		uint16_t fn;
+		switch (t)
+		{
+		case 0:
+			return which ? viterbi.DecodeLSF((lsf_t *)out, p) : decode_LSF((lsf_t *)out, p);
+		case 1:
+			return which ? viterbi.DecodeStream(out, lich, &fn, &lich_cnt, p) : decode_str_frame(out, lich, &fn, &lich_cnt, p);
+		default:
+			return which ? viterbi.DecodePacket(out, &eof, &pfn, p) : decode_pkt_frame(out, &eof, &pfn, p);
+		}
+	};
+
+	// first, make sure they agree
+	unsigned mismatches = 0;
+	for (unsigned t=0; t<3; t++)
+	{
+		for (unsigned c=0; c<copies; c++)
+		{
+			uint8_t out[2][30] {};
+			const auto e0 = decodeFrame(0, t, pld[t][c], out[0]);
+			const auto e1 = decodeFrame(1, t, pld[t][c], out[1]);
+			if (e0 != e1 or memcmp(out[0], out[1], 30))
+				mismatches++;
+		}
+	}
+	if (mismatches)
+	{
+		printf("ERROR: the decoders disagree on %u of %u frames\n", mismatches, 3u*copies);
+		return EXIT_FAILURE;
+	}
+	printf("Both decoders produce the same frames and error metrics\n");
+
+	// then time them
+	double seconds[2];
+	for (unsigned which=0; which<2; which++)
+	{
+		uint32_t sum = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (unsigned n=0; n<count; n++)
+		{
+			uint8_t out[30];
+			sum += decodeFrame(which, n % 3u, pld[n % 3u][(n / 3u) % copies], out);
+		}
+		seconds[which] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%s %u frames in %.3f s, %.0f frames/s (metric sum %u)\n", which ? "CViterbi:" : "libm17:  ", count, seconds[which], count / seconds[which], sum);
+	}
+	printf("CViterbi is %.2f times as fast as libm17\n", seconds[0] / seconds[1]);
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+//libm17
+#include <m17.h>
+
+#define VITERBI_MAX_STEPS 244	// the LSF: 240 bits plus 4 flushing bits
+
+// A soft-decision Viterbi decoder for the M17 K=5 convolutional code, with depuncturing.
+// The frame decoders take the same arguments and return the same error metric as
+// libm17's decode_LSF(), decode_str_frame() and decode_pkt_frame(), and produce the same results.
+// All 16 states are updated at once with 4-wide vectors, so it runs on NEON or SSE,
+// and each object has its own trellis, so decoders on different threads don't interfere.
+class CViterbi
+{
+public:
+	uint32_t DecodeLSF(lsf_t *lsf, const float pld_symbs[SYM_PER_PLD]);
+	uint32_t DecodeStream(uint8_t frame_data[16], uint8_t lich[6], uint16_t *fn, uint8_t *lich_cnt, const float pld_symbs[SYM_PER_PLD]);
+	uint32_t DecodePacket(uint8_t frame_data[25], uint8_t *eof, uint8_t *fn, const float pld_symbs[SYM_PER_PLD]);
+
+	// depuncture and decode in_len soft bits, just like libm17's viterbi_decode_punctured(),
+	// and like it, returns 0 if the depunctured bits won't fit in the trellis
+	uint32_t DecodePunctured(uint8_t *out, const uint16_t *in, const uint8_t *punct, const uint16_t in_len, const uint16_t p_len);
+
+private:
+	void softBits(uint16_t d_soft_bit[2*SYM_PER_PLD], const float pld_symbs[SYM_PER_PLD]) const;
+	uint32_t decode(uint8_t *out, const uint16_t *in, const uint16_t len);
+
+	uint16_t history[VITERBI_MAX_STEPS];
+};
@@ -0,0 +1,70 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "Worker.h"
+
+bool CWorker::Start(const std::string &n)
+{
+	name.assign(n);
+	keep_running = true;
+	workFuture = std::async(std::launch::async, &CWorker::run, this);
+	if (not workFuture.valid())
+	{
+		Log(EUnit::loop, "Could not start the %s thread\n", name.c_str());
+		keep_running = false;
+		return true;
+	}
+	return false;
+}
+
+void CWorker::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lg(mtx);
+		keep_running = false;
+	}
+	cv.notify_one();
+	if (workFuture.valid())
+		workFuture.get();
+}
+
+void CWorker::Post(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lg(mtx);
+		jobs.push(std::move(job));
+	}
+	cv.notify_one();
+}
+
+void CWorker::run()
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	while (true)
+	{
+		cv.wait(lck, [this] { return not keep_running or not jobs.empty(); });
+		if (jobs.empty())
+			break;	// stopped, and everything is done
+		auto job = std::move(jobs.front());
+		jobs.pop();
+		lck.unlock();
+		job();
+		lck.lock();
+	}
+}
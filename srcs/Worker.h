@@ -0,0 +1,52 @@
+/*
+	mspot - an M17 hot-spot using an  M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <queue>
+
+#include "Base.h"
+
+// A thread that runs jobs, one at a time, in the order they were posted. It's for the
+// database and file work that mustn't hold up the event loop.
+class CWorker : public CBase
+{
+public:
+	~CWorker() { Stop(); }
+	// returns true on error
+	bool Start(const std::string &name);
+	// the jobs that are already posted are run before it stops
+	void Stop();
+	// from any thread
+	void Post(std::function<void()> job);
+
+private:
+	void run();
+
+	std::string name;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::queue<std::function<void()>> jobs;
+	bool keep_running = false;
+	std::future<void> workFuture;
+};
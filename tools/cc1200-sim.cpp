@@ -0,0 +1,482 @@
+/*
+	cc1200-sim - a stand-in for the M17 CC1200 Raspberry Pi Hat
+				Copyright (C) 2026 Thomas A. Early
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// cc1200-sim makes a pseudo-terminal and answers on it like the HAT's firmware, so mspot can
+// run on a machine without the HAT. Point mspot at it in the ini file:
+//   [Modem]
+//   GpioChipDevice = "none"
+//   UartDevice = "/tmp/cc1200"    (the -l link, or the /dev/pts/N this prints)
+// The transmitter takes CMD_TX_DATA into a baseband buffer and empties it at 24 kS/s.
+// While the receiver is on, a CMD_RX_DATA frame is sent every 40 ms. Its samples come from
+// what was transmitted (with -L), or from capture files (with -i), or else they're silence.
+// The firmware is half-duplex, so with -L a transmission is heard as soon as RX is back on.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "CC1200Cmds.h"
+#include "Capture.h"
+
+#define SIM_BLOCK_LEN 960u				// samples in each CMD_TX_DATA and CMD_RX_DATA frame, 40 ms at 24 kS/s
+#define SIM_BSB_MAX (100u*SIM_BLOCK_LEN)	// the most TX baseband that's buffered, 4 s
+#define SIM_OUT_MAX 65536u				// the most that's waiting to be written to mspot
+#define SIM_IDENT "cc1200-sim 1.0"
+
+static volatile sig_atomic_t keep_running = 1;
+
+static void sigHandler(int)
+{
+	keep_running = 0;
+}
+
+static void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-l link] [-s speed] [-b boot_ms] [-L] [-R] [-v] [-h] [-i CaptureFile ...]\n", name);
+	fprintf(stderr, "-l makes a symbolic link to the pseudo-terminal, like /tmp/cc1200\n");
+	fprintf(stderr, "-s runs the baseband clock this many times faster than real time, the default is 1\n");
+	fprintf(stderr, "-b doesn't answer anything for this many ms, like the device booting\n");
+	fprintf(stderr, "-L loops the transmitted baseband back to the receiver\n");
+	fprintf(stderr, "-i injects capture files, or raw int8 baseband, into the receiver\n");
+	fprintf(stderr, "-R starts the capture files over when they're done\n");
+	fprintf(stderr, "-v logs every command\n");
+}
+
+class CSimulator
+{
+public:
+	bool Open(const std::string &link);
+	void Run(double speed, unsigned boot_ms);
+	void Close();
+
+	bool loopback = false, repeat = false, verbose = false;
+	std::vector<std::string> captures;
+
+private:
+	void tick();
+	void rxFrame();
+	size_t parse(const uint8_t *buf, size_t size);
+	void command(const std::vector<uint8_t> &frame);
+	void reply(uint8_t cid, const void *data, size_t size);
+	void status(uint8_t cid, uint8_t err) { reply(cid, &err, 1); }
+	void flush();
+	bool nextSamples(int8_t *out);
+
+	int master = -1, slave = -1;
+	std::string linkPath;
+	std::vector<uint8_t> in, out;
+	bool txOn = false, rxOn = false, afc = false, txStarted = false, starved = false;
+	uint32_t rxFreq = 0, txFreq = 0;
+	int16_t freqCorr = 0;
+	uint8_t power = 0;
+	std::deque<int8_t> txBsb, looped;
+	CCaptureReader reader;
+	size_t capIndex = 0;
+	bool capOpen = false;
+	uint64_t cmds = 0, txFrames = 0, rxFrames = 0, txOverflows = 0, txUnderruns = 0, rxDropped = 0;
+};
+
+bool CSimulator::Open(const std::string &link)
+{
+	master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (master < 0 or grantpt(master) or unlockpt(master))
+	{
+		fprintf(stderr, "Could not make a pseudo-terminal: %s\n", strerror(errno));
+		return true;
+	}
+	const char *name = ptsname(master);
+	// keep the slave open, so the master doesn't see a hang-up each time mspot closes it,
+	// and make it raw before mspot opens it, it only changes some of the flags
+	slave = open(name, O_RDWR | O_NOCTTY);
+	if (slave < 0)
+	{
+		fprintf(stderr, "Could not open %s: %s\n", name, strerror(errno));
+		return true;
+	}
+	struct termios tty;
+	if (0 == tcgetattr(slave, &tty))
+	{
+		cfmakeraw(&tty);
+		tcsetattr(slave, TCSANOW, &tty);
+	}
+	printf("The CC1200 simulator is on %s\n", name);
+	if (not link.empty())
+	{
+		unlink(link.c_str());
+		if (symlink(name, link.c_str()))
+		{
+			fprintf(stderr, "Could not link %s to %s: %s\n", link.c_str(), name, strerror(errno));
+			return true;
+		}
+		linkPath.assign(link);
+		printf("%s is linked to it\n", link.c_str());
+	}
+	return false;
+}
+
+void CSimulator::Close()
+{
+	reader.Close();
+	if (not linkPath.empty())
+		unlink(linkPath.c_str());
+	if (slave >= 0)
+		close(slave);
+	if (master >= 0)
+		close(master);
+	printf("%llu commands, %llu TX frames, %llu RX frames\n", (unsigned long long)cmds, (unsigned long long)txFrames, (unsigned long long)rxFrames);
+	printf("TX buffer: %llu overflows, %llu underruns, %llu RX frames dropped\n", (unsigned long long)txOverflows, (unsigned long long)txUnderruns, (unsigned long long)rxDropped);
+}
+
+// one block time, 40 ms of baseband at the simulated speed
+void CSimulator::tick()
+{
+	if (txOn)
+	{
+		const size_t n = std::min(size_t(SIM_BLOCK_LEN), txBsb.size());
+		// it ran dry after it started, if more comes before TX is stopped, that's an underrun
+		if (n < SIM_BLOCK_LEN and txStarted)
+			starved = true;
+		if (loopback)
+			looped.insert(looped.end(), txBsb.begin(), txBsb.begin() + n);
+		txBsb.erase(txBsb.begin(), txBsb.begin() + n);
+	}
+	if (rxOn)
+		rxFrame();
+}
+
+// the next block of received samples, returns false if there's nothing but silence
+bool CSimulator::nextSamples(int8_t *samples)
+{
+	if (looped.size() >= SIM_BLOCK_LEN)
+	{
+		std::copy(looped.begin(), looped.begin() + SIM_BLOCK_LEN, samples);
+		looped.erase(looped.begin(), looped.begin() + SIM_BLOCK_LEN);
+		return true;
+	}
+	SCaptureRecord rec;
+	while (capIndex < captures.size())
+	{
+		if (not capOpen)
+		{
+			capOpen = not reader.Open(captures[capIndex]);
+			if (not capOpen)
+			{
+				capIndex++;
+				continue;
+			}
+		}
+		if (reader.Read(rec))
+		{
+			memcpy(samples, rec.samples, SIM_BLOCK_LEN);
+			return true;
+		}
+		reader.Close();
+		capOpen = false;
+		if (++capIndex == captures.size() and repeat)
+			capIndex = 0;
+	}
+	return false;
+}
+
+void CSimulator::rxFrame()
+{
+	if (out.size() > SIM_OUT_MAX)
+	{
+		// mspot isn't reading, don't let it pile up
+		rxDropped++;
+		return;
+	}
+	const uint8_t head[3] { CMD_RX_DATA, uint8_t((SIM_BLOCK_LEN+3) & 0xffu), uint8_t((SIM_BLOCK_LEN+3) >> 8) };
+	int8_t samples[SIM_BLOCK_LEN];
+	if (not nextSamples(samples))
+		memset(samples, 0, SIM_BLOCK_LEN);
+	out.insert(out.end(), head, head + 3);
+	out.insert(out.end(), (const uint8_t *)samples, (const uint8_t *)samples + SIM_BLOCK_LEN);
+	rxFrames++;
+}
+
+void CSimulator::reply(uint8_t cid, const void *data, size_t size)
+{
+	const uint16_t len = uint16_t(size + 3);
+	const uint8_t head[3] { cid, uint8_t(len & 0xffu), uint8_t(len >> 8) };
+	out.insert(out.end(), head, head + 3);
+	out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+}
+
+void CSimulator::command(const std::vector<uint8_t> &frame)
+{
+	cmds++;
+	const uint8_t cid = frame[0];
+	const uint8_t *arg = frame.data() + 3;
+	const size_t alen = frame.size() - 3;
+	if (verbose and CMD_TX_DATA != cid and CMD_GET_BSB_BUFF != cid)
+		printf("Command 0x%02x with %u bytes\n", unsigned(cid), unsigned(alen));
+	switch (cid)
+	{
+		case CMD_PING:
+		{
+			const uint8_t err[4] { 0, 0, 0, 0 };
+			reply(cid, err, sizeof(err));
+			break;
+		}
+		case CMD_SET_RX_FREQ:
+		case CMD_SET_TX_FREQ:
+			if (4u != alen)
+				status(cid, ERR_CMD_MALFORM);
+			else
+			{
+				memcpy(CMD_SET_RX_FREQ == cid ? &rxFreq : &txFreq, arg, 4);
+				status(cid, ERR_OK);
+			}
+			break;
+		case CMD_SET_TX_POWER:
+			if (1u != alen)
+				status(cid, ERR_CMD_MALFORM);
+			else
+			{
+				power = arg[0];
+				status(cid, ERR_OK);
+			}
+			break;
+		case CMD_SET_FREQ_CORR:
+			if (2u != alen)
+				status(cid, ERR_CMD_MALFORM);
+			else
+			{
+				memcpy(&freqCorr, arg, 2);
+				status(cid, ERR_OK);
+			}
+			break;
+		case CMD_SET_AFC:
+		case CMD_DBG_ENABLE:
+			if (1u != alen)
+				status(cid, ERR_CMD_MALFORM);
+			else
+			{
+				if (CMD_SET_AFC == cid)
+					afc = (0 == arg[0]);
+				status(cid, ERR_OK);
+			}
+			break;
+		case CMD_TX_START:
+		case CMD_RX_START:
+		{
+			if (1u != alen)
+			{
+				status(cid, ERR_CMD_MALFORM);
+				break;
+			}
+			bool &on = (CMD_TX_START == cid) ? txOn : rxOn;
+			const bool want = (0 != arg[0]);
+			if (want and (CMD_TX_START == cid ? rxOn : txOn))
+				status(cid, ERR_BUSY);
+			else if (want == on)
+				status(cid, ERR_NOP);
+			else
+			{
+				on = want;
+				if (CMD_TX_START == cid)
+				{
+					txBsb.clear();
+					starved = txStarted = false;
+				}
+				status(cid, ERR_OK);
+			}
+			break;
+		}
+		case CMD_TX_DATA:
+			// no reply, the baseband just goes in the buffer
+			if (SIM_BLOCK_LEN != alen)
+				break;
+			txFrames++;
+			if (starved and txOn)
+				txUnderruns++;
+			starved = false;
+			txStarted = true;
+			if (txBsb.size() + SIM_BLOCK_LEN > SIM_BSB_MAX)
+				txOverflows++;
+			else
+				txBsb.insert(txBsb.end(), (const int8_t *)arg, (const int8_t *)arg + SIM_BLOCK_LEN);
+			break;
+		case CMD_GET_IDENT:
+			reply(cid, SIM_IDENT, strlen(SIM_IDENT));
+			break;
+		case CMD_GET_RX_FREQ:
+			reply(cid, &rxFreq, sizeof(rxFreq));
+			break;
+		case CMD_GET_TX_FREQ:
+			reply(cid, &txFreq, sizeof(txFreq));
+			break;
+		case CMD_GET_TX_POWER:
+			reply(cid, &power, sizeof(power));
+			break;
+		case CMD_GET_FREQ_CORR:
+			reply(cid, &freqCorr, sizeof(freqCorr));
+			break;
+		case CMD_GET_BSB_BUFF:
+		{
+			const uint32_t level = uint32_t(txBsb.size());
+			reply(cid, &level, sizeof(level));
+			break;
+		}
+		default:
+			status(cid, ERR_CMD_MALFORM);
+			break;
+	}
+}
+
+// Pull whole frames out of what mspot wrote, returns how many bytes were used.
+size_t CSimulator::parse(const uint8_t *buf, size_t size)
+{
+	size_t n = 0;
+	while (size - n >= 3)
+	{
+		const size_t len = buf[n+1] | (size_t(buf[n+2]) << 8);
+		if (len < 3u or len > SIM_BLOCK_LEN + 3u)
+		{
+			// not a frame, skip a byte and look again
+			n++;
+			continue;
+		}
+		if (size - n < len)
+			break;
+		command(std::vector<uint8_t>(buf + n, buf + n + len));
+		n += len;
+	}
+	return n;
+}
+
+void CSimulator::flush()
+{
+	while (not out.empty())
+	{
+		const ssize_t n = write(master, out.data(), out.size());
+		if (n <= 0)
+			return;
+		out.erase(out.begin(), out.begin() + n);
+	}
+}
+
+void CSimulator::Run(double speed, unsigned boot_ms)
+{
+	const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(40.0 / speed));
+	const auto booted = std::chrono::steady_clock::now() + std::chrono::milliseconds(boot_ms);
+	auto next = std::chrono::steady_clock::now() + period;
+	uint8_t buf[4096];
+	while (keep_running)
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= next)
+		{
+			tick();
+			next += period;
+			// don't try to catch up after a long stall
+			if (next < now)
+				next = now + period;
+		}
+		flush();
+
+		struct pollfd pfd { master, POLLIN, 0 };
+		if (not out.empty())
+			pfd.events |= POLLOUT;
+		const int wait = int(std::chrono::ceil<std::chrono::milliseconds>(next - std::chrono::steady_clock::now()).count());
+		if (poll(&pfd, 1, std::max(wait, 0)) <= 0 or 0 == (pfd.revents & POLLIN))
+			continue;
+		const ssize_t n = read(master, buf, sizeof(buf));
+		if (n <= 0)
+			continue;
+		// while it's "booting", whatever is sent is lost
+		if (std::chrono::steady_clock::now() < booted)
+			continue;
+		in.insert(in.end(), buf, buf + n);
+		in.erase(in.begin(), in.begin() + parse(in.data(), in.size()));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	CSimulator sim;
+	std::string link;
+	double speed = 1.0;
+	unsigned boot_ms = 0;
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "l:s:b:LRvi:h")))
+	{
+		switch (opt)
+		{
+			case 'l':
+				link.assign(optarg);
+				break;
+			case 's':
+				speed = atof(optarg);
+				break;
+			case 'b':
+				boot_ms = unsigned(atoi(optarg));
+				break;
+			case 'L':
+				sim.loopback = true;
+				break;
+			case 'R':
+				sim.repeat = true;
+				break;
+			case 'v':
+				sim.verbose = true;
+				break;
+			case 'i':
+				sim.captures.emplace_back(optarg);
+				break;
+			case 'h':
+				PrintUsage(argv[0]);
+				return EXIT_SUCCESS;
+			default:
+				PrintUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	// the rest of the arguments are capture files, too
+	for (int a=optind; a<argc; a++)
+		sim.captures.emplace_back(argv[a]);
+	if (speed <= 0.0)
+	{
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::signal(SIGINT,  sigHandler);
+	std::signal(SIGTERM, sigHandler);
+	if (sim.Open(link))
+	{
+		sim.Close();
+		return EXIT_FAILURE;
+	}
+	sim.Run(speed, boot_ms);
+	sim.Close();
+	return EXIT_SUCCESS;
+}